@@ -9,6 +9,11 @@
 
 # Add any project specific keep options here:
 
+# called back from native-lib
+-keepclassmembers class edu.gmu.cs.CirclsClient.StreamDecoder {
+    private void onPacket(char[]);
+}
+
 # If your project uses WebView with JS, uncomment the following
 # and specify the fully qualified class name to the JavaScript interface
 # class:
@@ -0,0 +1,48 @@
+#include "arena.hpp"
+
+// takes a pointer, returns the first aligned address at or after it
+static uint8_t *align(uint8_t *p)
+{
+    return (uint8_t *)(((uintptr_t)p + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1));
+}
+
+void *Arena::allocate(size_t bytes)
+{
+    bytes = (bytes + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (used + bytes <= size) {
+        void *p = base + used;
+        used += bytes;
+        if (used + spilled > peak) {
+            peak = used + spilled;
+        }
+        return p;
+    }
+
+    // spill until the outermost scope ends, then make the block big enough
+    spill.emplace_back(new uint8_t[bytes + ARENA_ALIGN]);
+    spilled += bytes;
+    if (used + spilled > peak) {
+        peak = used + spilled;
+    }
+    return align(spill.back().get());
+}
+
+void Arena::leave(size_t mark)
+{
+    used = mark;
+    if (--depth > 0 || spill.empty()) {
+        return;
+    }
+
+    spill.clear();
+    spilled = 0;
+    size = peak + peak / 4;
+    block.reset(new uint8_t[size + ARENA_ALIGN]);
+    base = align(block.get());
+}
+
+Arena &threadArena()
+{
+    static thread_local Arena arena;
+    return arena;
+}
@@ -0,0 +1,64 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <memory>
+#include <vector>
+
+#define ARENA_ALIGN 16      // every allocation, enough for SIMD loads
+
+// scratch memory of one thread; allocations are a pointer bump and are
+// returned all at once when the ArenaScope that took them ends; the arena
+// grows to the most a frame needed, so a steady resolution never allocates
+class Arena {
+public:
+    // returns count uninitialized values, zeroed if zero is set
+    template <typename T>
+    T *alloc(size_t count, bool zero = false)
+    {
+        void *p = allocate(count * sizeof(T));
+        if (zero) {
+            memset(p, 0, count * sizeof(T));
+        }
+        return (T *)p;
+    }
+
+    // opens a scope, returns the bytes in use
+    size_t enter() { depth++; return used; }
+
+    // closes a scope, returning everything allocated since mark
+    void leave(size_t mark);
+
+    // returns the bytes reserved
+    size_t capacity() const { return size; }
+
+private:
+    void *allocate(size_t bytes);
+
+    std::unique_ptr<uint8_t[]> block;               // one block once warmed up
+    uint8_t *base = nullptr;                        // block, aligned
+    size_t size = 0;
+    size_t used = 0;
+    std::vector<std::unique_ptr<uint8_t[]>> spill;  // when the block ran out
+    size_t spilled = 0;                             // bytes in spill
+    size_t peak = 0;                                // the most in use at once
+    int depth = 0;                                  // scopes open
+};
+
+// returns the calling thread's arena
+Arena &threadArena();
+
+// returns to an arena everything allocated from it during its lifetime
+class ArenaScope {
+public:
+    explicit ArenaScope(Arena &arena = threadArena()) : arena(arena), start(arena.enter()) {}
+    ~ArenaScope() { arena.leave(start); }
+
+    Arena &arena;
+
+private:
+    size_t start;
+};
+
+#endif // ARENA_HPP
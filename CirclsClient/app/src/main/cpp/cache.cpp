@@ -0,0 +1,72 @@
+#include "cache.hpp"
+#include "hash.hpp"
+#include <string.h>
+
+#define WARM_UPDATES 8  // updates credited to cached centroids
+
+size_t saveCache(uint8_t *out, size_t len, int frameWidth, int frameHeight, const Roi &roi,
+                 const ColorCalibrator &colors, float symbolWidth)
+{
+    if (len < sizeof(CacheBlob)) {
+        return 0;
+    }
+
+    CacheBlob blob;
+    memset(&blob, 0, sizeof(blob));
+    blob.magic = CACHE_MAGIC;
+    blob.version = CACHE_VERSION;
+    blob.size = sizeof(blob);
+    blob.frameWidth = frameWidth;
+    blob.frameHeight = frameHeight;
+    blob.symbolWidth = symbolWidth;
+    if (roi.valid && roi.frameWidth == frameWidth && roi.frameHeight == frameHeight) {
+        blob.roi[0] = roi.left;
+        blob.roi[1] = roi.top;
+        blob.roi[2] = roi.right;
+        blob.roi[3] = roi.bottom;
+    }
+    memcpy(blob.centroid, colors.centroid, sizeof(blob.centroid));
+    blob.checksum = fingerprint(&blob, offsetof(CacheBlob, checksum));
+
+    memcpy(out, &blob, sizeof(blob));
+    return sizeof(blob);
+}
+
+bool loadCache(const uint8_t *data, size_t len, int frameWidth, int frameHeight,
+               Roi &roi, ColorCalibrator &colors, float &symbolWidth)
+{
+    CacheBlob blob;
+    if (len != sizeof(blob)) {
+        return false;
+    }
+    memcpy(&blob, data, sizeof(blob));
+
+    if (blob.magic != CACHE_MAGIC || blob.version != CACHE_VERSION || blob.size != sizeof(blob)
+        || blob.checksum != fingerprint(&blob, offsetof(CacheBlob, checksum)))
+    {
+        return false;
+    }
+
+    // colors do not depend on the resolution
+    memcpy(colors.centroid, blob.centroid, sizeof(colors.centroid));
+    for (int k = 0; k < NUM_CLASSES; k++) {
+        colors.updates[k] = WARM_UPDATES;
+    }
+    colors.confirmed = true;
+
+    // geometry only carries over to the same resolution
+    if (blob.frameWidth == frameWidth && blob.frameHeight == frameHeight) {
+        symbolWidth = blob.symbolWidth;
+        roi = Roi();
+        roi.frameWidth = frameWidth;
+        roi.frameHeight = frameHeight;
+        roi.left = blob.roi[0];
+        roi.top = blob.roi[1];
+        roi.right = blob.roi[2];
+        roi.bottom = blob.roi[3];
+        roi.valid = roi.width() > 0 && roi.height() > 0
+                    && roi.right <= frameWidth && roi.bottom <= frameHeight;
+    }
+
+    return true;
+}
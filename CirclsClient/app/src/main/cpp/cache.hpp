@@ -0,0 +1,37 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+#include <stddef.h>
+#include <stdint.h>
+#include "calibrate.hpp"
+#include "roi.hpp"
+
+#define CACHE_MAGIC   0x534c4343  // "CCLS"
+#define CACHE_VERSION 2
+
+// learned receiver state carried over between sessions
+struct CacheBlob {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;          // bytes in the blob, checksum included
+
+    int32_t frameWidth;     // camera resolution the state was learned at
+    int32_t frameHeight;
+    float symbolWidth;      // pixels per symbol slot, 0 if unknown
+    int32_t roi[4];         // left, top, right, bottom, all 0 if unknown
+    float centroid[NUM_CLASSES][3];
+
+    uint64_t checksum;      // fingerprint of everything before it
+};
+
+// takes the camera resolution and the state learned at it, writes a blob of
+// sizeof(CacheBlob) bytes into out
+// returns the number of bytes written, or 0 if out is too small
+size_t saveCache(uint8_t *out, size_t len, int frameWidth, int frameHeight, const Roi &roi,
+                 const ColorCalibrator &colors, float symbolWidth);
+
+// takes a blob from saveCache and the current camera resolution
+// returns false and leaves the state untouched if the blob is stale or corrupt
+bool loadCache(const uint8_t *blob, size_t len, int frameWidth, int frameHeight,
+               Roi &roi, ColorCalibrator &colors, float &symbolWidth);
+
+#endif // CACHE_HPP
@@ -0,0 +1,233 @@
+#include "calibrate.hpp"
+#include <string.h>
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define L_WEIGHT    0.5f    // luminance varies more with exposure than chroma
+#define MIN_PIXELS  3       // fewest pixels needed to move a centroid
+#define MIN_RATE    0.1f    // slowest blending rate once calibrated
+
+const char SYMBOL_CLASSES[NUM_CLASSES] = { '0', '1', 'R', 'G', 'B', 'Y' };
+
+// +L = white, +a = red; -a = green; -b = blue; +b = yellow;
+static const float DEFAULT_CENTROIDS[NUM_CLASSES][3] = {
+    {   0,   0,   0 },  // off
+    { 160,   0,   0 },  // white
+    { 100,  60,   0 },  // red
+    { 100, -60,   0 },  // green
+    { 100,   0, -60 },  // blue
+    { 100,   0,  60 },  // yellow
+};
+
+ColorCalibrator::ColorCalibrator()
+{
+    reset();
+}
+
+void ColorCalibrator::reset()
+{
+    memcpy(centroid, DEFAULT_CENTROIDS, sizeof(centroid));
+    memset(updates, 0, sizeof(updates));
+    confirmed = false;
+}
+
+// takes a flat Lab pixel, returns the index of the nearest centroid
+static int nearest(const float centroid[][3], int32_t L, int32_t a, int32_t b)
+{
+    int best = 0;
+    float bestDist = 0;
+
+    for (int k = 0; k < NUM_CLASSES; k++) {
+        float dL = L - centroid[k][0];
+        float da = a - centroid[k][1];
+        float db = b - centroid[k][2];
+        float dist = L_WEIGHT * dL * dL + da * da + db * db;
+        if (k == 0 || dist < bestDist) {
+            best = k;
+            bestDist = dist;
+        }
+    }
+
+    return best;
+}
+
+char ColorCalibrator::classify(int32_t L, int32_t a, int32_t b) const
+{
+    return SYMBOL_CLASSES[nearest(centroid, L, a, b)];
+}
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+// takes 16 flat Lab pixels, stores the index of their nearest centroids
+static void nearest16(const float centroid[][3], const int32_t frame[][3], uint8_t classes[])
+{
+    uint16x4_t half[4];
+    for (int q = 0; q < 4; q++) {
+        int32x4x3_t lab = vld3q_s32(frame[q * 4]);
+        float32x4_t L = vcvtq_f32_s32(lab.val[0]);
+        float32x4_t a = vcvtq_f32_s32(lab.val[1]);
+        float32x4_t b = vcvtq_f32_s32(lab.val[2]);
+
+        float32x4_t bestDist = vdupq_n_f32(0);
+        uint32x4_t best = vdupq_n_u32(0);
+        for (int k = 0; k < NUM_CLASSES; k++) {
+            float32x4_t dL = vsubq_f32(L, vdupq_n_f32(centroid[k][0]));
+            float32x4_t da = vsubq_f32(a, vdupq_n_f32(centroid[k][1]));
+            float32x4_t db = vsubq_f32(b, vdupq_n_f32(centroid[k][2]));
+            float32x4_t dist = vmulq_f32(vmulq_n_f32(dL, L_WEIGHT), dL);
+            dist = vaddq_f32(dist, vmulq_f32(da, da));
+            dist = vaddq_f32(dist, vmulq_f32(db, db));
+            if (k == 0) {
+                bestDist = dist;
+                continue;
+            }
+            uint32x4_t closer = vcltq_f32(dist, bestDist);
+            bestDist = vbslq_f32(closer, dist, bestDist);
+            best = vbslq_u32(closer, vdupq_n_u32(k), best);
+        }
+        half[q] = vmovn_u32(best);
+    }
+    vst1_u8(classes, vmovn_u16(vcombine_u16(half[0], half[1])));
+    vst1_u8(classes + 8, vmovn_u16(vcombine_u16(half[2], half[3])));
+}
+#elif defined(__SSE2__)
+// takes 16 flat Lab pixels, stores the index of their nearest centroids
+static void nearest16(const float centroid[][3], const int32_t frame[][3], uint8_t classes[])
+{
+    __m128i quad[4];
+    for (int q = 0; q < 4; q++) {
+        // deinterleave four Lab pixels
+        const __m128i *p = (const __m128i *)frame[q * 4];
+        __m128 v0 = _mm_castsi128_ps(_mm_loadu_si128(p));
+        __m128 v1 = _mm_castsi128_ps(_mm_loadu_si128(p + 1));
+        __m128 v2 = _mm_castsi128_ps(_mm_loadu_si128(p + 2));
+        __m128 t = _mm_shuffle_ps(v1, v2, _MM_SHUFFLE(1, 1, 2, 2));
+        __m128i Li = _mm_castps_si128(_mm_shuffle_ps(v0, t, _MM_SHUFFLE(2, 0, 3, 0)));
+        __m128 u = _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(0, 0, 1, 1));
+        t = _mm_shuffle_ps(v1, v2, _MM_SHUFFLE(2, 2, 3, 3));
+        __m128i ai = _mm_castps_si128(_mm_shuffle_ps(u, t, _MM_SHUFFLE(2, 0, 2, 0)));
+        u = _mm_shuffle_ps(v0, v1, _MM_SHUFFLE(1, 1, 2, 2));
+        __m128i bi = _mm_castps_si128(_mm_shuffle_ps(u, v2, _MM_SHUFFLE(3, 0, 2, 0)));
+        __m128 L = _mm_cvtepi32_ps(Li), a = _mm_cvtepi32_ps(ai), b = _mm_cvtepi32_ps(bi);
+
+        __m128 bestDist = _mm_setzero_ps();
+        __m128i best = _mm_setzero_si128();
+        for (int k = 0; k < NUM_CLASSES; k++) {
+            __m128 dL = _mm_sub_ps(L, _mm_set1_ps(centroid[k][0]));
+            __m128 da = _mm_sub_ps(a, _mm_set1_ps(centroid[k][1]));
+            __m128 db = _mm_sub_ps(b, _mm_set1_ps(centroid[k][2]));
+            __m128 dist = _mm_mul_ps(_mm_mul_ps(dL, _mm_set1_ps(L_WEIGHT)), dL);
+            dist = _mm_add_ps(dist, _mm_mul_ps(da, da));
+            dist = _mm_add_ps(dist, _mm_mul_ps(db, db));
+            if (k == 0) {
+                bestDist = dist;
+                continue;
+            }
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(dist, bestDist));
+            bestDist = _mm_min_ps(dist, bestDist);
+            best = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(k)), _mm_andnot_si128(closer, best));
+        }
+        quad[q] = best;
+    }
+    __m128i lo = _mm_packs_epi32(quad[0], quad[1]);
+    __m128i hi = _mm_packs_epi32(quad[2], quad[3]);
+    _mm_storeu_si128((__m128i *)classes, _mm_packus_epi16(lo, hi));
+}
+#endif
+
+void ColorCalibrator::classify(const int32_t frame[][3], int pixels, uint8_t classes[]) const
+{
+    int i = 0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(__SSE2__)
+    for (; i + 16 <= pixels; i += 16) {
+        nearest16(centroid, frame + i, classes + i);
+    }
+#endif
+    for (; i < pixels; i++) {
+        classes[i] = nearest(centroid, frame[i][0], frame[i][1], frame[i][2]);
+    }
+}
+
+// takes a flat frame, a pixel range, the centroids and the number of classes
+// to learn, the first ones of SYMBOL_CLASSES
+// adds the interiors of the runs of those classes to the sums and counts of
+// their nearest centroid, skipping blurred edges
+static void cluster(const int32_t frame[][3], int begin, int end, const float centroid[][3], int classes,
+                    float sum[][3], uint32_t count[])
+{
+    int prev = -1, cur = -1;
+    for (int i = begin; i < end; i++) {
+        int next = nearest(centroid, frame[i][0], frame[i][1], frame[i][2]);
+        if (cur >= 0 && cur < classes && cur == prev && cur == next) {
+            sum[cur][0] += frame[i - 1][0];
+            sum[cur][1] += frame[i - 1][1];
+            sum[cur][2] += frame[i - 1][2];
+            count[cur]++;
+        }
+        prev = cur;
+        cur = next;
+    }
+}
+
+// takes the centroids, their update counts and the sums and counts of the
+// pixels assigned to each
+// moves each centroid towards the mean of its cluster
+static void blend(float centroid[][3], uint32_t updates[], const float sum[][3], const uint32_t count[])
+{
+    for (int k = 0; k < NUM_CLASSES; k++) {
+        if (count[k] < MIN_PIXELS) {
+            continue;
+        }
+
+        float rate = 1.0f / (updates[k] + 2);
+        if (rate < MIN_RATE) {
+            rate = MIN_RATE;
+        }
+        for (int c = 0; c < 3; c++) {
+            centroid[k][c] += rate * (sum[k][c] / count[k] - centroid[k][c]);
+        }
+        updates[k]++;
+    }
+}
+
+void ColorCalibrator::update(const int32_t frame[][3], int begin, int end)
+{
+    // a packet that failed would teach the colors its own errors, its pixels
+    // are only worth more than the defaults
+    if (confirmed) {
+        return;
+    }
+
+    float sum[NUM_CLASSES][3];
+    uint32_t count[NUM_CLASSES];
+    memset(sum, 0, sizeof(sum));
+    memset(count, 0, sizeof(count));
+    cluster(frame, begin, end, centroid, NUM_CLASSES, sum, count);
+    blend(centroid, updates, sum, count);
+}
+
+void ColorCalibrator::update(const int32_t frame[][3], int begin, int end, const float soft[][3],
+                             const uint8_t codeword[], int symbols)
+{
+    float sum[NUM_CLASSES][3];
+    uint32_t count[NUM_CLASSES];
+    memset(sum, 0, sizeof(sum));
+    memset(count, 0, sizeof(count));
+
+    // data symbols are labeled by the codeword, two bits each from the low
+    // end of every byte, R G B Y as slice() reads them
+    for (int n = 0; n < symbols; n++) {
+        int k = 2 + ((codeword[n / 4] >> (n % 4 * 2)) & 3);
+        sum[k][0] += soft[n][0];
+        sum[k][1] += soft[n][1];
+        sum[k][2] += soft[n][2];
+        count[k]++;
+    }
+
+    // the codeword says nothing of off and white
+    cluster(frame, begin, end, centroid, 2, sum, count);
+    blend(centroid, updates, sum, count);
+    confirmed = true;
+}
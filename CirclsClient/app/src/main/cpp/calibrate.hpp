@@ -0,0 +1,48 @@
+#ifndef CALIBRATE_HPP
+#define CALIBRATE_HPP
+#include <stdint.h>
+
+// symbol classes in 01RGBY representation
+#define NUM_CLASSES 6
+extern const char SYMBOL_CLASSES[NUM_CLASSES];
+
+// learns the Lab color of each symbol class from the frames being received
+// and classifies pixels by their nearest class centroid
+class ColorCalibrator {
+public:
+    ColorCalibrator();
+
+    // forget everything learned this session
+    void reset();
+
+    // takes a flat Lab pixel, returns its 01RGBY symbol
+    char classify(int32_t L, int32_t a, int32_t b) const;
+
+    // takes a flat frame, stores the SYMBOL_CLASSES index of every pixel in
+    // classes; vectorized where the target has SIMD, otherwise as above
+    void classify(const int32_t frame[][3], int pixels, uint8_t classes[]) const;
+
+    // takes a flat frame and the pixel range of a packet that failed to
+    // decode in it
+    // runs one k-means step over the range and blends the result in, only
+    // until a packet decoded
+    void update(const int32_t frame[][3], int begin, int end);
+
+    // takes a flat frame, the pixel range of a packet that decoded in it,
+    // the packet's soft symbols and its corrected codeword
+    // blends in the mean of the soft symbols of each data color as the
+    // codeword has them, and one k-means step of the off and white pixels
+    void update(const int32_t frame[][3], int begin, int end, const float soft[][3], const uint8_t codeword[],
+                int symbols);
+
+    // class centroids in the same order as SYMBOL_CLASSES
+    float centroid[NUM_CLASSES][3];
+
+    // number of updates that moved each centroid
+    uint32_t updates[NUM_CLASSES];
+
+    // learned from a decoded packet, or loaded from a session that was
+    bool confirmed;
+};
+
+#endif // CALIBRATE_HPP
@@ -0,0 +1,258 @@
+#include "capture.hpp"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "metrics.hpp"
+
+CaptureWriter::~CaptureWriter()
+{
+    close();
+}
+
+bool CaptureWriter::open(const char *path, uint32_t flags)
+{
+    close();
+    file = fopen(path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    CaptureHeader header;
+    header.magic = CAPTURE_MAGIC;
+    header.version = CAPTURE_VERSION;
+    header.headerSize = sizeof(CaptureHeader);
+    header.frameSize = sizeof(CaptureFrame);
+    header.regionSize = sizeof(CaptureRegion);
+    header.flags = flags;
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        fclose(file);
+        file = nullptr;
+        return false;
+    }
+
+    captureFlags = flags;
+    queued = written = 0;
+    closing = false;
+    thread = std::thread(&CaptureWriter::write, this);
+    return true;
+}
+
+void CaptureWriter::close()
+{
+    if (file == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        closing = true;
+    }
+    wake.notify_one();
+    thread.join();
+    fclose(file);
+    file = nullptr;
+    writing = false;
+}
+
+bool CaptureWriter::beginFrame(int64_t timestamp, int width, int height, int tier)
+{
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        writing = file != nullptr && queued - written < CAPTURE_QUEUE;
+    }
+    if (!writing) {
+        metricsCount(CAPTURE_DROPPED);
+        return false;
+    }
+
+    // the writer only reads the records queued before this one
+    std::vector<uint8_t> &record = records[queued % CAPTURE_QUEUE];
+    record.resize(sizeof(CaptureFrame));
+    CaptureFrame frame = {};
+    frame.timestamp = timestamp;
+    frame.width = width;
+    frame.height = height;
+    frame.tier = tier;
+    memcpy(record.data(), &frame, sizeof(frame));
+    return true;
+}
+
+void CaptureWriter::addRegion(int receiver, unsigned generation, const Roi &rect, int rowStep, int rows, float snr,
+                              const int32_t flat[][3], const Runs *runs)
+{
+    if (!writing) {
+        return;
+    }
+
+    CaptureRegion region = {};
+    region.left = rect.left;
+    region.top = rect.top;
+    region.right = rect.right;
+    region.bottom = rect.bottom;
+    region.receiver = receiver;
+    region.rowStep = rowStep;
+    region.rows = rows;
+    region.snr = snr;
+    region.runs = (captureFlags & CAPTURE_RUNS) && runs != nullptr ? runs->size() : 0;
+    region.generation = generation;
+
+    std::vector<uint8_t> &record = records[queued % CAPTURE_QUEUE];
+    size_t at = record.size();
+    record.resize(at + region.size(), 0);
+    uint8_t *out = record.data() + at;
+    memcpy(out, &region, sizeof(region));
+    out += sizeof(region);
+
+    if (region.runs > 0) {
+        memcpy(out, runs->width.data(), region.runs * sizeof(uint16_t));
+        out += region.runs * sizeof(uint16_t);
+    }
+
+    // the flat frame is averaged Lab, so it fits in 8 bits as it came from
+    // the conversion
+    for (int j = 0; j < region.columns(); j++) {
+        *out++ = flat[j][0];
+        *out++ = flat[j][1] + 128;
+        *out++ = flat[j][2] + 128;
+    }
+
+    if (region.runs > 0) {
+        memcpy(out, runs->symbol.data(), region.runs);
+    }
+
+    auto *frame = (CaptureFrame *)record.data();
+    frame->regions++;
+}
+
+void CaptureWriter::endFrame()
+{
+    if (!writing) {
+        return;
+    }
+    writing = false;
+
+    std::vector<uint8_t> &record = records[queued % CAPTURE_QUEUE];
+    ((CaptureFrame *)record.data())->size = record.size();
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        queued++;
+    }
+    wake.notify_one();
+    metricsCount(FRAMES_CAPTURED);
+}
+
+void CaptureWriter::write()
+{
+    std::unique_lock<std::mutex> lk(lock);
+    while (true) {
+        wake.wait(lk, [this] { return closing || written < queued; });
+        if (written == queued) {
+            break;
+        }
+
+        // the record stays put until it is counted as written
+        std::vector<uint8_t> &record = records[written % CAPTURE_QUEUE];
+        lk.unlock();
+        fwrite(record.data(), 1, record.size(), file);
+        lk.lock();
+        written++;
+    }
+    fflush(file);
+}
+
+
+CaptureReader::~CaptureReader()
+{
+    close();
+}
+
+bool CaptureReader::open(const char *path)
+{
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CaptureHeader)) {
+        ::close(fd);
+        return false;
+    }
+
+    // the mapping outlives the descriptor
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    data = (const uint8_t *)map;
+    length = st.st_size;
+
+    header = (const CaptureHeader *)data;
+    if (header->magic != CAPTURE_MAGIC || header->version != CAPTURE_VERSION
+        || header->headerSize != sizeof(CaptureHeader) || header->frameSize != sizeof(CaptureFrame)
+        || header->regionSize != sizeof(CaptureRegion))
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void CaptureReader::close()
+{
+    if (data != nullptr) {
+        munmap((void *)data, length);
+    }
+    data = nullptr;
+    length = 0;
+    header = nullptr;
+}
+
+const CaptureFrame *CaptureReader::first() const
+{
+    return header != nullptr ? frameAt(data + header->headerSize) : nullptr;
+}
+
+const CaptureFrame *CaptureReader::next(const CaptureFrame *frame) const
+{
+    return frameAt((const uint8_t *)frame + frame->size);
+}
+
+const CaptureFrame *CaptureReader::frameAt(const uint8_t *at) const
+{
+    // the writer may have been stopped in the middle of a record
+    size_t left = data + length - at;
+    if (left < sizeof(CaptureFrame)) {
+        return nullptr;
+    }
+    auto *frame = (const CaptureFrame *)at;
+    if (frame->size < sizeof(CaptureFrame) || frame->size > left || frame->size % 8 != 0) {
+        return nullptr;
+    }
+
+    // every region within the record, so they are read without checks
+    const uint8_t *end = at + frame->size;
+    const CaptureRegion *region = frame->first();
+    for (int i = 0; i < frame->regions; i++, region = frame->next(region)) {
+        if ((size_t)(end - (const uint8_t *)region) < sizeof(CaptureRegion) || region->columns() <= 0
+            || region->size() > (size_t)(end - (const uint8_t *)region))
+        {
+            return nullptr;
+        }
+    }
+    return frame;
+}
+
+
+void captureProfile(const CaptureRegion &region, int32_t flat[][3])
+{
+    const uint8_t *lab = region.profile();
+    for (int j = 0; j < region.columns(); j++, lab += 3) {
+        flat[j][0] = lab[0];
+        flat[j][1] = lab[1] - 128;
+        flat[j][2] = lab[2] - 128;
+    }
+}
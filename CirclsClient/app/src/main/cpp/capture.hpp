@@ -0,0 +1,160 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "roi.hpp"
+#include "runs.hpp"
+
+// compact recording of what the receiver saw: the flat frame of every region
+// instead of the camera frame, a few KB per frame instead of a few MB, so
+// replaying a capture only runs the stages after the reduction
+//
+// a capture is a CaptureHeader followed by a record per committed frame; all
+// records and regions start 8 byte aligned, so a mapped capture is read in
+// place; little endian like every target
+
+#define CAPTURE_MAGIC   0x50414343  // "CCAP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_RUNS    0x1         // flag: regions carry their symbol runs
+#define CAPTURE_QUEUE   64          // frames waiting for the writer before new ones are dropped
+
+struct CaptureHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t headerSize;    // sizeof(CaptureHeader)
+    uint16_t frameSize;     // sizeof(CaptureFrame)
+    uint16_t regionSize;    // sizeof(CaptureRegion)
+    uint32_t flags;         // CAPTURE_ flags
+};
+
+// a region of a frame, followed by the u16 width of each run, the flat frame
+// as 8 bit Lab pixels like OpenCV's, a and b offset by 128, and the 01RGBY
+// symbol of each run
+struct CaptureRegion {
+    int16_t left;           // part of the frame reduced, right and bottom
+    int16_t top;            // exclusive
+    int16_t right;
+    int16_t bottom;
+    uint8_t receiver;       // index of the receiver that decoded it
+    uint8_t rowStep;        // rows skipped by the reduction
+    uint16_t rows;          // rows reduced
+    float snr;              // stripe SNR of the reduction
+    uint32_t runs;          // runs stored, 0 unless CAPTURE_RUNS
+    uint32_t generation;    // changes when the receiver is handed another transmitter
+
+    int columns() const { return right - left; }
+    const uint16_t *runWidths() const { return (const uint16_t *)(this + 1); }
+    const uint8_t *profile() const { return (const uint8_t *)(runWidths() + runs); }
+    const char *runSymbols() const { return (const char *)(profile() + columns() * 3); }
+
+    // bytes of the region with its data, padded for the next one
+    size_t size() const { return (sizeof(*this) + runs * 3 + columns() * 3 + 7) & ~(size_t)7; }
+};
+
+// one committed frame, followed by its regions
+struct CaptureFrame {
+    int64_t timestamp;      // ns
+    uint32_t size;          // bytes of the record, regions included
+    uint16_t width;         // camera resolution
+    uint16_t height;
+    uint16_t regions;
+    uint8_t tier;           // how much of it was decoded, see schedule.hpp
+    uint8_t reserved[5];
+
+    const CaptureRegion *first() const { return (const CaptureRegion *)(this + 1); }
+    const CaptureRegion *next(const CaptureRegion *region) const
+    {
+        return (const CaptureRegion *)((const uint8_t *)region + region->size());
+    }
+};
+
+// appends frames to a capture from the thread committing them; a background
+// thread writes them out, so the decoder never waits for storage
+class CaptureWriter {
+public:
+    ~CaptureWriter();
+
+    // takes a path and CAPTURE_ flags
+    // starts a capture there, returns false if it cannot be created
+    bool open(const char *path, uint32_t flags);
+
+    // waits for the frames queued to be written, then closes the capture
+    void close();
+
+    bool isOpen() const { return file != nullptr; }
+    uint32_t flags() const { return captureFlags; }
+
+    // takes a frame's timestamp, resolution and tier
+    // starts its record, returns false if it is dropped because the writer
+    // fell behind, in which case its regions are ignored
+    bool beginFrame(int64_t timestamp, int width, int height, int tier);
+
+    // takes a region, the receiver that decoded it and that receiver's
+    // generation, how it was reduced, its flat frame and, with CAPTURE_RUNS,
+    // its runs
+    // adds it to the frame begun
+    void addRegion(int receiver, unsigned generation, const Roi &rect, int rowStep, int rows, float snr,
+                   const int32_t flat[][3], const Runs *runs);
+
+    // queues the frame begun for writing
+    void endFrame();
+
+private:
+    // writes queued frames until the capture is closed
+    void write();
+
+    FILE *file = nullptr;
+    uint32_t captureFlags = 0;
+    bool writing = false;               // a frame is begun, only the committing thread reads it
+
+    // records handed to the writer thread, reused so the steady state does not
+    // allocate
+    std::vector<uint8_t> records[CAPTURE_QUEUE];
+    uint64_t queued = 0;                // records queued
+    uint64_t written = 0;               // records written
+    bool closing = false;
+    std::mutex lock;                    // guards the counts and closing
+    std::condition_variable wake;       // a record was queued or the capture closes
+    std::thread thread;
+};
+
+// a capture mapped into memory, its frames are read in place
+class CaptureReader {
+public:
+    ~CaptureReader();
+
+    // takes a path
+    // maps the capture there, returns false if it is not a capture of a
+    // version this build reads
+    bool open(const char *path);
+
+    void close();
+
+    uint32_t flags() const { return header != nullptr ? header->flags : 0; }
+
+    // returns the first frame, nullptr if there is none
+    const CaptureFrame *first() const;
+
+    // takes a frame of the capture
+    // returns the one after it, nullptr at the end or where the capture was cut short
+    const CaptureFrame *next(const CaptureFrame *frame) const;
+
+private:
+    // takes a position in the mapping, returns the frame there if it is whole
+    const CaptureFrame *frameAt(const uint8_t *at) const;
+
+    const uint8_t *data = nullptr;
+    size_t length = 0;
+    const CaptureHeader *header = nullptr;
+};
+
+// takes a region of a capture and a flat frame of its columns
+// expands the region's profile into it
+void captureProfile(const CaptureRegion &region, int32_t flat[][3]);
+
+#endif // CAPTURE_HPP
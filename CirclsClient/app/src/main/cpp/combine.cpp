@@ -0,0 +1,98 @@
+#include "combine.hpp"
+#include <math.h>
+#include "demod.hpp"
+
+#define MIN_AGREEMENT 0.75f // share of equal symbols for two attempts to match
+#define MAX_AGE       8     // frames an attempt is kept without a repeat
+
+Combiner::Combiner(int symbols) : symbols(symbols)
+{
+    for (Entry &entry : entries) {
+        entry.sum.assign(symbols * 3, 0);
+    }
+}
+
+int Combiner::combine(const float soft[][3], float snr, const ColorCalibrator &colors, float out[][3])
+{
+    // the id is never corrected, an attempt without it could be any packet
+    uint8_t id;
+    uint8_t erasures[1];
+    int numErasures;
+    slice(&id, soft, 4, colors, erasures, numErasures);
+    if (numErasures > 0) {
+        return -1;
+    }
+
+    // stored attempt at the same packet with the most symbols in agreement
+    int best = -1;
+    float bestAgreement = MIN_AGREEMENT;
+    for (int e = 0; e < COMBINE_ENTRIES; e++) {
+        Entry &entry = entries[e];
+        if (entry.count == 0 || entry.id != id) {
+            continue;
+        }
+
+        int same = 0;
+        for (int n = 0; n < symbols; n++) {
+            const float *s = &entry.sum[n * 3];
+            char mean = colors.classify(lroundf(s[0] / entry.weight), lroundf(s[1] / entry.weight),
+                                        lroundf(s[2] / entry.weight));
+            same += mean == colors.classify(lroundf(soft[n][0]), lroundf(soft[n][1]), lroundf(soft[n][2]));
+        }
+        float agreement = (float)same / symbols;
+        if (agreement >= bestAgreement) {
+            best = e;
+            bestAgreement = agreement;
+        }
+    }
+
+    // start over in a free or the oldest entry if nothing matches
+    if (best < 0) {
+        best = 0;
+        for (int e = 0; e < COMBINE_ENTRIES; e++) {
+            if (entries[e].count == 0) {
+                best = e;
+                break;
+            }
+            if (entries[e].age > entries[best].age) {
+                best = e;
+            }
+        }
+        forget(best);
+        entries[best].id = id;
+    }
+
+    // maximum-ratio combining of the Lab values
+    Entry &entry = entries[best];
+    float weight = snr > 0 ? snr : 1;
+    for (int n = 0; n < symbols; n++) {
+        for (int c = 0; c < 3; c++) {
+            entry.sum[n * 3 + c] += weight * soft[n][c];
+            out[n][c] = entry.sum[n * 3 + c] / (entry.weight + weight);
+        }
+    }
+    entry.weight += weight;
+    entry.count++;
+    entry.age = 0;
+
+    return best;
+}
+
+void Combiner::forget(int entry)
+{
+    Entry &e = entries[entry];
+    e.sum.assign(symbols * 3, 0);
+    e.weight = 0;
+    e.count = 0;
+    e.age = 0;
+    e.id = -1;
+}
+
+void Combiner::tick()
+{
+    for (int e = 0; e < COMBINE_ENTRIES; e++) {
+        if (entries[e].count > 0 && ++entries[e].age > MAX_AGE) {
+            forget(e);
+        }
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef COMBINE_HPP
+#define COMBINE_HPP
+#include <vector>
+#include "calibrate.hpp"
+
+#define COMBINE_ENTRIES 4   // packets accumulated at once
+
+// accumulates the soft symbols of packets that failed to decode, aligned by
+// their position in the packet, so repeats of a weak packet can be decoded
+// from their weighted average; the transmitter numbers its packets in their
+// first byte, so only attempts with the same id are combined
+class Combiner {
+public:
+    // takes the number of symbols in a packet
+    explicit Combiner(int symbols);
+
+    // takes the soft symbols of a packet that failed to decode and its SNR
+    // adds them to the stored attempt with the same id they agree with, or
+    // replaces the oldest one, writes the weighted average to out and returns
+    // the entry used; returns -1 and leaves out alone if the id is unreadable
+    int combine(const float soft[][3], float snr, const ColorCalibrator &colors, float out[][3]);
+
+    // returns the number of attempts accumulated in an entry
+    int count(int entry) const { return entries[entry].count; }
+
+    // drops an entry once its packet decoded
+    void forget(int entry);
+
+    // ages the entries once per frame, dropping stale ones
+    void tick();
+
+private:
+    struct Entry {
+        std::vector<float> sum;     // snr weighted Lab of each symbol
+        float weight = 0;           // sum of the snr weights
+        int id = -1;                // first byte of the packet, as sliced
+        int count = 0;              // attempts accumulated
+        int age = 0;                // frames since the last attempt
+    };
+
+    int symbols;
+    Entry entries[COMBINE_ENTRIES];
+};
+
+#endif // COMBINE_HPP
@@ -0,0 +1,462 @@
+#include "demod.hpp"
+#include "arena.hpp"
+#include <math.h>
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+#define MIN_CONTRAST  10.0f   // weakest on/off luminance step of a preamble
+#define MIN_EDGE      6.0f    // weakest color/off step used to lock the clock
+#define PHASE_GAIN    0.5f    // share of the edge error applied to the phase
+#define PERIOD_GAIN   0.05f   // share of the edge error applied to the period
+#define MAX_DRIFT     0.1f    // largest period change allowed within a packet
+#define MIN_SCORE     0.6f    // weakest normalized correlation accepted as a preamble
+#define MIN_SLOT      1.5f    // narrowest slot searched for
+#define SLOT_STEP     1.04f   // ratio between neighboring candidate slot widths
+#define SLOT_RANGE    0.3f    // relative range searched around a known slot width
+#define CHROMA_WEIGHT 8.0f    // penalty on color inside a preamble window
+#define DECIMATE      4       // pixels per block of the coarse profile
+#define REGION_GAP    4       // quiet blocks bridged within a region, slot unknown
+
+// takes a flat frame and a fractional pixel range
+// averages the Lab pixels whose centers fall inside, or the nearest pixel
+static void sample(const int32_t frame[][3], int pixels, float from, float to, float out[3])
+{
+    int first = (int)ceilf(from);
+    int last = (int)floorf(to);
+    if (first < 0) {
+        first = 0;
+    }
+    if (last >= pixels) {
+        last = pixels - 1;
+    }
+    if (last < first) {
+        first = last = (int)lroundf((from + to) / 2);
+        if (first < 0) {
+            first = last = 0;
+        } else if (first >= pixels) {
+            first = last = pixels - 1;
+        }
+    }
+
+    out[0] = out[1] = out[2] = 0;
+    for (int i = first; i <= last; i++) {
+        out[0] += frame[i][0];
+        out[1] += frame[i][1];
+        out[2] += frame[i][2];
+    }
+    int n = last - first + 1;
+    out[0] /= n;
+    out[1] /= n;
+    out[2] /= n;
+}
+
+// takes a flat frame, a pixel range and a luminance threshold
+// returns the sub-pixel position where L first rises (or falls) through the
+// threshold, or -1 if it does not
+static float crossing(const int32_t frame[][3], int pixels, float from, float to, float threshold,
+                      bool rising)
+{
+    int first = (int)floorf(from);
+    int last = (int)ceilf(to);
+    if (first < 1) {
+        first = 1;
+    }
+    if (last >= pixels) {
+        last = pixels - 1;
+    }
+
+    for (int i = first; i <= last; i++) {
+        float prev = frame[i - 1][0];
+        float cur = frame[i][0];
+        if (rising ? (prev < threshold && cur >= threshold) : (prev >= threshold && cur < threshold)) {
+            return i - 1 + (threshold - prev) / (cur - prev);
+        }
+    }
+
+    return -1;
+}
+
+int findRegions(const int32_t frame[][3], int pixels, float expected, std::vector<Window> &regions,
+                float &slot)
+{
+    regions.clear();
+    slot = 0;
+
+    // blocks inside a wide slot do not swing, bridge at least an off gap
+    int gap = REGION_GAP;
+    if (expected > 0) {
+        gap = std::max(gap, (int)ceilf(2 * expected / DECIMATE));
+    }
+
+    // a block of the coarse profile is active if its luminance swings like
+    // an on/off edge, which holds however the slots fall within the block
+    int blocks = pixels / DECIMATE;
+    int start = -1, quiet = 0;
+    for (int n = 0; n <= blocks; n++) {
+        bool active = false;
+        if (n < blocks) {
+            int32_t lo = frame[n * DECIMATE][0], hi = lo;
+            for (int i = n * DECIMATE + 1; i < (n + 1) * DECIMATE; i++) {
+                lo = std::min(lo, frame[i][0]);
+                hi = std::max(hi, frame[i][0]);
+            }
+            active = hi - lo >= MIN_CONTRAST;
+        }
+
+        if (active) {
+            if (start < 0) {
+                start = n;
+            }
+            quiet = 0;
+        } else if (start >= 0 && (++quiet > gap || n == blocks)) {
+            // a region must hold at least a preamble at the narrowest slot
+            int end = n - quiet + 1;
+            if ((end - start) * DECIMATE >= PREAMBLE_SLOTS * MIN_SLOT) {
+                Window region;
+                region.first = std::max(start - 1, 0) * DECIMATE;
+                region.last = std::min((end + 1) * DECIMATE, pixels) - 1;
+                regions.push_back(region);
+            }
+            start = -1;
+        }
+    }
+
+    // colors sit well above off, so luminance crosses a quarter of the way up
+    // about twice per symbol, once per slot
+    int crossings = 0, span = 0;
+    for (const Window &region : regions) {
+        int32_t lo = frame[region.first][0], hi = lo;
+        for (int i = region.first; i <= region.last; i++) {
+            lo = std::min(lo, frame[i][0]);
+            hi = std::max(hi, frame[i][0]);
+        }
+        int32_t threshold = lo + (hi - lo) / 4;
+        for (int i = region.first + 1; i <= region.last; i++) {
+            crossings += (frame[i - 1][0] < threshold) != (frame[i][0] < threshold);
+        }
+        span += region.last - region.first + 1;
+    }
+    if (crossings > 0) {
+        slot = (float)span / crossings;
+    }
+
+    return regions.size();
+}
+
+bool findSync(const Runs &runs, float expected, Sync &sync)
+{
+    const char *symbol = runs.symbol.data();
+    const uint16_t *width = runs.width.data();
+
+    for (int i = 7; i < runs.size(); i++) {
+        // look for sync sequence
+        if (symbol[i - 7] == '1'
+            && symbol[i - 6] == '0'
+            && symbol[i - 5] == '1'
+            && symbol[i - 4] == '0'
+            && symbol[i - 3] == '1'
+            && symbol[i - 2] == '0'
+            && symbol[i - 1] == '1'
+            && symbol[i] == '0')
+        {
+            int on = width[i - 7] + width[i - 5] + width[i - 3] + width[i - 1];
+            float slot = on / 4.0f;
+            if (expected <= 0 || fabsf(slot - expected) <= expected / 2) {
+                sync.begin = runs.start[i - 7];
+                sync.slot = slot;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+int correlateSync(const int32_t frame[][3], int pixels, float expected, std::vector<Sync> &syncs)
+{
+    return correlateSync(frame, pixels, expected, std::vector<Window>(1, Window{0, pixels - 1}), syncs);
+}
+
+int correlateSync(const int32_t frame[][3], int pixels, float expected, const std::vector<Window> &windows,
+                  std::vector<Sync> &syncs)
+{
+    // running sums of the luminance, its square and the chroma
+    ArenaScope scope;
+    float *sum = scope.arena.alloc<float>(pixels + 1), *sumSq = scope.arena.alloc<float>(pixels + 1);
+    float *sumA = scope.arena.alloc<float>(pixels + 1), *sumB = scope.arena.alloc<float>(pixels + 1);
+    float *sumC = scope.arena.alloc<float>(pixels + 1);
+    sum[0] = sumSq[0] = sumA[0] = sumB[0] = sumC[0] = 0;
+    for (int i = 0; i < pixels; i++) {
+        float L = frame[i][0], a = frame[i][1], b = frame[i][2];
+        sum[i + 1] = sum[i] + L;
+        sumSq[i + 1] = sumSq[i] + L * L;
+        sumA[i + 1] = sumA[i] + a;
+        sumB[i + 1] = sumB[i] + b;
+        sumC[i + 1] = sumC[i] + a * a + b * b;
+    }
+
+    float minSlot = MIN_SLOT, maxSlot = (float)pixels / (PREAMBLE_SLOTS * 2);
+    if (expected > 0) {
+        minSlot = expected * (1 - SLOT_RANGE);
+        maxSlot = expected * (1 + SLOT_RANGE);
+    }
+
+    // best score of each offset over all slot widths
+    float *score = scope.arena.alloc<float>(pixels);
+    float *best = scope.arena.alloc<float>(pixels, true), *slot = scope.arena.alloc<float>(pixels, true);
+    for (float w = minSlot; w <= maxSlot; w *= SLOT_STEP) {
+        // slot boundaries, white weighted +2 and off -1 so the template is zero mean
+        int edge[PREAMBLE_SLOTS + 1];
+        for (int m = 0; m <= PREAMBLE_SLOTS; m++) {
+            edge[m] = lroundf(m * w);
+        }
+        int length = edge[PREAMBLE_SLOTS];
+        int last = pixels - length;
+        if (last < 0) {
+            break;
+        }
+        // rounding leaves the template slightly off zero mean, remove it
+        float weight = 0, energy = 0;
+        for (int m = 0; m < PREAMBLE_SLOTS; m++) {
+            int t = m % 3 ? -1 : 2;
+            weight += t * (edge[m + 1] - edge[m]);
+            energy += t * t * (edge[m + 1] - edge[m]);
+        }
+        energy -= weight * weight / length;
+
+        // the template is piecewise constant, so each offset is a fixed
+        // combination of running sums
+        for (const Window &win : windows) {
+            int first = std::max(win.first, 0);
+            int stop = std::min(win.last, last);
+
+            for (int m = 0; m < PREAMBLE_SLOTS; m += 3) {
+                int a = edge[m], b = edge[m + 1], c = edge[m + 3];
+                const float *sa = &sum[a], *sb = &sum[b], *sc = &sum[c];
+                for (int x = first; x <= stop; x++) {
+                    float on = sb[x] - sa[x];
+                    float off = sc[x] - sb[x];
+                    score[x] = (m ? score[x] : 0) + 2 * on - off;
+                }
+            }
+
+            // normalize by the energy of the window, zero mean
+            for (int x = first; x <= stop; x++) {
+                float s = sum[x + length] - sum[x];
+                float variance = sumSq[x + length] - sumSq[x] - s * s / length;
+                float corr = score[x] - weight * s / length;
+                float rho = variance > 0 ? corr / sqrtf(variance * energy) : 0;
+
+                // the preamble is white and off only, discount colorful windows
+                float sa = sumA[x + length] - sumA[x];
+                float sb = sumB[x + length] - sumB[x];
+                float chroma = sumC[x + length] - sumC[x] - (sa * sa + sb * sb) / length;
+                rho *= variance / (variance + CHROMA_WEIGHT * chroma);
+
+                if (rho > best[x]) {
+                    best[x] = rho;
+                    slot[x] = w;
+                }
+            }
+        }
+    }
+
+    // keep peaks that dominate half a preamble on either side
+    syncs.clear();
+    for (int x = 0; x < pixels; x++) {
+        if (best[x] < MIN_SCORE) {
+            continue;
+        }
+
+        int radius = (int)(PREAMBLE_SLOTS * slot[x] / 2);
+        bool peak = true;
+        for (int y = x - radius; y <= x + radius && peak; y++) {
+            if (y >= 0 && y < pixels && y != x) {
+                peak = best[y] < best[x] || (best[y] == best[x] && y > x);
+            }
+        }
+        if (peak) {
+            Sync sync;
+            sync.begin = x;
+            sync.slot = slot[x];
+            sync.score = best[x];
+            syncs.push_back(sync);
+        }
+    }
+
+    return syncs.size();
+}
+
+bool refineSync(const int32_t frame[][3], int pixels, Sync &sync)
+{
+    float w = sync.slot;
+    int first = sync.begin;
+    int last = (int)(first + 12 * w);
+    if (w < 1 || last > pixels) {
+        return false;
+    }
+
+    // white covers a third of the preamble and off the rest
+    ArenaScope scope;
+    size_t n = last - first;
+    int32_t *levels = scope.arena.alloc<int32_t>(n);
+    for (int i = first; i < last; i++) {
+        levels[i - first] = frame[i][0];
+    }
+    std::sort(levels, levels + n);
+    sync.offL = std::accumulate(levels, levels + n * 2 / 5, 0.0f) / (n * 2 / 5);
+    sync.onL = std::accumulate(levels + n - n / 5, levels + n, 0.0f) / (n / 5);
+    if (n < 5 || sync.onL - sync.offL < MIN_CONTRAST) {
+        return false;
+    }
+
+    // walk the white slots edge by edge and fit a line through their middles,
+    // measured between both edges so exposure blur cancels out
+    float threshold = (sync.onL + sync.offL) / 2;
+    float sumN = 0, sumM = 0, sumNN = 0, sumNM = 0;
+    int count = 0;
+    float from = first - w;
+    for (int k = 0; k < 4; k++) {
+        float rise = crossing(frame, pixels, from, from + 2 * w, threshold, true);
+        if (rise < 0) {
+            break;
+        }
+        float fall = crossing(frame, pixels, rise, rise + 2 * w, threshold, false);
+        if (fall < 0) {
+            break;
+        }
+
+        float middle = (rise + fall) / 2;
+        sumN += k;
+        sumM += middle;
+        sumNN += k * k;
+        sumNM += k * middle;
+        count++;
+
+        // skip most of the off gap
+        from = fall + w / 2;
+    }
+    if (count < 2) {
+        return false;
+    }
+
+    float period = (count * sumNM - sumN * sumM) / (count * sumNN - sumN * sumN);
+    float middle = (sumM - period * sumN) / count;
+    if (fabsf(period - 3 * w) > w) {
+        return false;
+    }
+
+    // white, off, off per preamble period
+    sync.slot = period / 3;
+    sync.start = middle - sync.slot / 2 + 4 * period;
+    return true;
+}
+
+int demodulate(float soft[][3], int maxSymbols, const int32_t frame[][3], int pixels,
+               Sync &sync, int &end)
+{
+    int n = 0;         // symbol index
+    float period = 2 * sync.slot;   // color slot followed by an off slot
+    float nominal = period;
+    float phase = sync.start;       // expected rising edge of the next symbol
+    float lab[3];
+
+    end = -1;
+
+    while (n < maxSymbols) {
+        float w = period / 2;
+        if (phase + w >= pixels) {
+            break;
+        }
+
+        // lock the clock to the edges of this symbol
+        sample(frame, pixels, phase + w / 4, phase + w * 3 / 4, lab);
+        if (lab[0] - sync.offL >= MIN_EDGE) {
+            float threshold = (lab[0] + sync.offL) / 2;
+            float rise = crossing(frame, pixels, phase - w / 2, phase + w / 2, threshold, true);
+            float fall = crossing(frame, pixels, phase + w / 2, phase + w * 1.5f, threshold, false);
+
+            float error = 0;
+            if (rise >= 0 && fall >= 0) {
+                error = (rise + fall) / 2 - (phase + w / 2);
+            } else if (rise >= 0) {
+                error = rise - phase;
+            } else if (fall >= 0) {
+                error = fall - (phase + w);
+            }
+            if (fabsf(error) < w / 2) {
+                phase += PHASE_GAIN * error;
+                period += PERIOD_GAIN * error;
+                if (period > nominal * (1 + MAX_DRIFT)) {
+                    period = nominal * (1 + MAX_DRIFT);
+                } else if (period < nominal * (1 - MAX_DRIFT)) {
+                    period = nominal * (1 - MAX_DRIFT);
+                }
+            }
+        }
+
+        // sample the middle half of the symbol
+        sample(frame, pixels, phase + w / 4, phase + w * 3 / 4, soft[n]);
+        n++;
+
+        end = (int)ceilf(phase + w);
+        phase += period;
+    }
+
+    // leave the clock where the next symbol would be
+    sync.start = phase;
+    sync.slot = period / 2;
+    return n;
+}
+
+int slice(uint8_t data[], const float soft[][3], int symbols, const ColorCalibrator &colors,
+          uint8_t erasures[], int &numErasures)
+{
+    int j = 0;         // data index
+    int k = 0;         // bit index
+
+    numErasures = 0;
+
+    for (int n = 0; n < symbols; n++) {
+        uint8_t b = 0;
+        switch (colors.classify(lroundf(soft[n][0]), lroundf(soft[n][1]), lroundf(soft[n][2]))) {
+            case 'R':
+                b = 0b00;
+                break;
+            case 'G':
+                b = 0b01;
+                break;
+            case 'B':
+                b = 0b10;
+                break;
+            case 'Y':
+                b = 0b11;
+                break;
+            default:
+                // not a data symbol, let the decoder fill it in
+                if (numErasures == 0 || erasures[numErasures - 1] != j) {
+                    erasures[numErasures++] = j;
+                }
+                break;
+        }
+
+        // new byte
+        if (k == 0) {
+            data[j] = 0;
+        }
+
+        // insert data symbol
+        data[j] |= b << k;
+
+        // update bit index
+        k = (k + 2) % 8;
+
+        // next byte?
+        if (k == 0) {
+            j++;
+        }
+    }
+
+    return j;
+}
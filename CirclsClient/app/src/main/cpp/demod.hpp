@@ -0,0 +1,67 @@
+#ifndef DEMOD_HPP
+#define DEMOD_HPP
+#include <stdint.h>
+#include <vector>
+#include "calibrate.hpp"
+#include "runs.hpp"
+
+// white, off, off repeated four times ahead of every packet
+#define PREAMBLE_SLOTS 12
+
+// preamble found in a flat frame
+struct Sync {
+    int begin = -1;     // first pixel of the preamble
+    float start = 0;    // expected rising edge of the first data symbol
+    float slot = 0;     // pixels per symbol slot
+    float offL = 0;     // luminance of an off slot
+    float onL = 0;      // luminance of a white slot
+    float score = 0;    // normalized correlation with the preamble
+};
+
+// range of pixels, inclusive
+struct Window {
+    int first;
+    int last;
+};
+
+// takes a flat frame and a slot width to expect, 0 if unknown
+// scans a decimated luminance profile for regions that swing enough to carry
+// symbols and estimates their slot width from the edge rate, returns the
+// number of regions stored in regions; frames without any can be dropped
+int findRegions(const int32_t frame[][3], int pixels, float expected, std::vector<Window> &regions,
+                float &slot);
+
+// takes a flat frame and a slot width to expect, 0 if unknown
+// matches the luminance profile against the preamble template at every offset
+// and candidate slot width, returns the number of correlation peaks stored in
+// syncs in the order they appear in the frame
+int correlateSync(const int32_t frame[][3], int pixels, float expected, std::vector<Sync> &syncs);
+
+// same, but only tries offsets inside the given ordered, disjoint windows
+int correlateSync(const int32_t frame[][3], int pixels, float expected, const std::vector<Window> &windows,
+                  std::vector<Sync> &syncs);
+
+// takes symbol runs and a slot width to expect, 0 if unknown
+// returns true and fills sync at the first preamble whose slot width agrees
+bool findSync(const Runs &runs, float expected, Sync &sync);
+
+// takes a flat frame and the preamble found in it
+// measures the preamble edges at sub-pixel precision and fills in the slot
+// width, luminance levels and data start, returns false if the edges are unclear
+bool refineSync(const int32_t frame[][3], int pixels, Sync &sync);
+
+// takes a flat frame and the preamble found in it
+// samples the Lab color of up to maxSymbols data symbols into soft, returns
+// the number sampled; symbol centers are found at sub-pixel precision and the
+// symbol clock is re-locked at every color edge; the first pixel after the
+// last symbol is stored in end, and sync.start and sync.slot are left at the
+// clock of the next symbol so demodulation can continue in a later frame
+int demodulate(float soft[][3], int maxSymbols, const int32_t frame[][3], int pixels,
+               Sync &sync, int &end);
+
+// takes soft symbols, four per byte, returns the bytes they classify to
+// bytes holding a symbol that is not a color are listed in erasures
+int slice(uint8_t data[], const float soft[][3], int symbols, const ColorCalibrator &colors,
+          uint8_t erasures[], int &numErasures);
+
+#endif // DEMOD_HPP
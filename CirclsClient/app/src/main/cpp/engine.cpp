@@ -0,0 +1,129 @@
+#include "engine.hpp"
+
+FrameEngine::FrameEngine(int workers, int depth, Analyze analyze, Commit commit)
+    : analyze(analyze), commit(commit), depth(depth), remaining(depth, 0)
+{
+    if (workers <= 0) {
+        workers = std::max(1, (int)std::thread::hardware_concurrency());
+    }
+    for (int i = 0; i < workers; i++) {
+        queues.emplace_back(new Queue());
+    }
+    for (int i = 0; i < workers; i++) {
+        threads.emplace_back(&FrameEngine::work, this, i);
+    }
+}
+
+FrameEngine::~FrameEngine()
+{
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+int64_t FrameEngine::submit(const std::function<int(int64_t frame)> &prepare)
+{
+    // room for another frame
+    int64_t frame;
+    {
+        std::unique_lock<std::mutex> lk(lock);
+        progress.wait(lk, [this] { return submitted - committed < depth; });
+        frame = submitted;
+    }
+
+    // the frame is not visible to the workers until it is counted
+    int tasks = prepare(frame);
+
+    std::unique_lock<std::mutex> lk(lock);
+    submitted++;
+    remaining[frame % depth] = tasks;
+    if (tasks <= 0) {
+        commitReady(lk);
+        return frame;
+    }
+
+    // spread the tasks over the queues, idle workers even them out
+    for (int k = 0; k < tasks; k++) {
+        Queue &queue = *queues[nextQueue];
+        nextQueue = (nextQueue + 1) % queues.size();
+        std::lock_guard<std::mutex> qlk(queue.lock);
+        queue.tasks.push_back(Task{frame, k});
+    }
+    queued += tasks;
+    wake.notify_all();
+    return frame;
+}
+
+void FrameEngine::wait(int64_t frame)
+{
+    std::unique_lock<std::mutex> lk(lock);
+    progress.wait(lk, [this, frame] { return committed > frame; });
+}
+
+int FrameEngine::inFlight()
+{
+    std::lock_guard<std::mutex> lk(lock);
+    return (int)(submitted - committed);
+}
+
+bool FrameEngine::take(int worker, Task &task)
+{
+    int count = queues.size();
+    for (int i = 0; i < count; i++) {
+        Queue &queue = *queues[(worker + i) % count];
+        std::lock_guard<std::mutex> qlk(queue.lock);
+        if (!queue.tasks.empty()) {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+            queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void FrameEngine::commitReady(std::unique_lock<std::mutex> &lk)
+{
+    if (committing) {
+        return;
+    }
+
+    // the committing thread picks up frames finished meanwhile by others
+    committing = true;
+    while (committed < submitted && remaining[committed % depth] <= 0) {
+        int64_t frame = committed;
+        lk.unlock();
+        commit(frame);
+        lk.lock();
+        committed++;
+        progress.notify_all();
+    }
+    committing = false;
+}
+
+void FrameEngine::work(int worker)
+{
+    while (true) {
+        Task task;
+        if (!take(worker, task)) {
+            std::unique_lock<std::mutex> lk(lock);
+            wake.wait(lk, [this] { return stopping || queued > 0; });
+            if (stopping) {
+                return;
+            }
+            continue;
+        }
+
+        analyze(worker, task.frame, task.task);
+
+        std::unique_lock<std::mutex> lk(lock);
+        if (--remaining[task.frame % depth] == 0) {
+            commitReady(lk);
+        }
+    }
+}
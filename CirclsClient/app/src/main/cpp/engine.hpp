@@ -0,0 +1,85 @@
+#ifndef ENGINE_HPP
+#define ENGINE_HPP
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// runs frames through a work-stealing pool; every frame is split into tasks
+// analyzed in parallel on any worker, then the frames are committed one at a
+// time in the order they were submitted
+class FrameEngine {
+public:
+    // analyzes one task of a frame on the given worker
+    typedef std::function<void(int worker, int64_t frame, int task)> Analyze;
+
+    // applies a frame once all of its tasks are done
+    typedef std::function<void(int64_t frame)> Commit;
+
+    // takes the number of workers, 0 for one per core, and the number of
+    // frames allowed in flight; frames are numbered from 0 and frame n may
+    // reuse the storage of frame n - depth once it is committed
+    FrameEngine(int workers, int depth, Analyze analyze, Commit commit);
+    ~FrameEngine();
+
+    // waits for room, then calls prepare on the calling thread with the
+    // number of the new frame; it returns the number of tasks to analyze,
+    // which may be 0; returns the frame number
+    // frames are not queued, callers must not submit from two threads at once
+    int64_t submit(const std::function<int(int64_t frame)> &prepare);
+
+    // waits until the given frame has been committed
+    void wait(int64_t frame);
+
+    // returns the frames submitted but not committed yet
+    int inFlight();
+
+    int workers() const { return (int)queues.size(); }
+
+private:
+    struct Task {
+        int64_t frame;
+        int task;
+    };
+
+    // tasks handed to one worker, others steal from them when idle
+    struct Queue {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    // takes a worker, returns true and the oldest task of its own queue,
+    // otherwise the oldest one it can steal
+    bool take(int worker, Task &task);
+
+    // commits every finished frame in order, unless another thread already is
+    // lk must hold lock
+    void commitReady(std::unique_lock<std::mutex> &lk);
+
+    void work(int worker);
+
+    Analyze analyze;
+    Commit commit;
+    int depth;
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<int> queued{0};         // tasks waiting in any queue
+    int nextQueue = 0;                  // queue the next task goes to
+
+    std::mutex lock;                    // guards the frame counts below
+    std::condition_variable wake;       // tasks were queued or the engine stops
+    std::condition_variable progress;   // a frame was committed
+    std::vector<int> remaining;         // tasks left per frame slot
+    int64_t submitted = 0;              // frames submitted
+    int64_t committed = 0;              // frames committed
+    bool committing = false;            // a thread is committing frames
+    bool stopping = false;
+};
+
+#endif // ENGINE_HPP
@@ -0,0 +1,19 @@
+#ifndef HASH_HPP
+#define HASH_HPP
+#include <stddef.h>
+#include <stdint.h>
+
+#define FINGERPRINT_SEED 0xcbf29ce484222325ull
+
+// takes bytes and the fingerprint of whatever came before them
+// returns their 64 bit FNV-1a fingerprint, cheap enough to run on every frame
+inline uint64_t fingerprint(const void *bytes, size_t len, uint64_t hash = FINGERPRINT_SEED)
+{
+    auto *p = (const uint8_t *)bytes;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ p[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+#endif // HASH_HPP
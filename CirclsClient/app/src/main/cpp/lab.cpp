@@ -0,0 +1,70 @@
+#include "lab.hpp"
+#include <math.h>
+
+#define CBRT_STEPS 4096     // samples of the Lab companding curve over [0, 1]
+
+// D65 white point
+#define WHITE_X 0.950456f
+#define WHITE_Z 1.088754f
+
+// sRGB primaries to XYZ, with X and Z already divided by the white point
+static const float XYZ[3][3] = {
+    {0.412453f / WHITE_X, 0.357580f / WHITE_X, 0.180423f / WHITE_X},
+    {0.212671f,           0.715160f,           0.072169f},
+    {0.019334f / WHITE_Z, 0.119193f / WHITE_Z, 0.950227f / WHITE_Z},
+};
+
+// tables filled once, before the first conversion
+struct LabTables {
+    float linear[256];              // sRGB byte to linear light
+    float curve[CBRT_STEPS + 2];    // Lab companding of t = i / CBRT_STEPS
+
+    LabTables()
+    {
+        for (int i = 0; i < 256; i++) {
+            float v = i / 255.0f;
+            linear[i] = v <= 0.04045f ? v / 12.92f : powf((v + 0.055f) / 1.055f, 2.4f);
+        }
+        for (int i = 0; i < CBRT_STEPS + 2; i++) {
+            float t = (float)i / CBRT_STEPS;
+            curve[i] = t > 0.008856f ? cbrtf(t) : 7.787f * t + 16.0f / 116.0f;
+        }
+    }
+};
+
+static const LabTables tables;
+
+// takes t in [0, 1], returns its Lab companding, interpolated from the table
+static inline float companding(float t)
+{
+    t = t < 0 ? 0 : t > 1 ? 1 : t;
+    float x = t * CBRT_STEPS;
+    int i = (int)x;
+    return tables.curve[i] + (tables.curve[i + 1] - tables.curve[i]) * (x - i);
+}
+
+// takes a value, returns it rounded and clamped to a byte
+static inline uint8_t saturate(float v)
+{
+    int i = (int)lrintf(v);
+    return (uint8_t)(i < 0 ? 0 : i > 255 ? 255 : i);
+}
+
+void rgbaToLab(const uint8_t *rgba, int count, uint8_t *lab)
+{
+    for (int i = 0; i < count; i++, rgba += 4, lab += 3) {
+        float r = tables.linear[rgba[0]];
+        float g = tables.linear[rgba[1]];
+        float b = tables.linear[rgba[2]];
+
+        float fx = companding(XYZ[0][0] * r + XYZ[0][1] * g + XYZ[0][2] * b);
+        float y = XYZ[1][0] * r + XYZ[1][1] * g + XYZ[1][2] * b;
+        float fy = companding(y);
+        float fz = companding(XYZ[2][0] * r + XYZ[2][1] * g + XYZ[2][2] * b);
+
+        float L = y > 0.008856f ? 116.0f * fy - 16.0f : 903.3f * y;
+        lab[0] = saturate(L * 255.0f / 100.0f);
+        lab[1] = saturate(500.0f * (fx - fy) + 128.0f);
+        lab[2] = saturate(200.0f * (fy - fz) + 128.0f);
+    }
+}
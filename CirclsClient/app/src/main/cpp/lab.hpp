@@ -0,0 +1,11 @@
+#ifndef LAB_HPP
+#define LAB_HPP
+#include <stdint.h>
+
+// takes count RGBA pixels
+// stores their 8 bit CIE Lab in lab, three bytes per pixel, scaled the way
+// OpenCV's COLOR_RGB2Lab does: L * 255 / 100, a + 128 and b + 128, from sRGB
+// under a D65 white point; within one step of it
+void rgbaToLab(const uint8_t *rgba, int count, uint8_t *lab);
+
+#endif // LAB_HPP
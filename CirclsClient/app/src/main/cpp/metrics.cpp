@@ -0,0 +1,173 @@
+#include "metrics.hpp"
+#include <stdio.h>
+
+static const char *COUNTER_NAMES[NUM_COUNTERS] = {
+    "frames_submitted", "frames_dropped", "frames_skipped", "frames_degraded", "regions_analyzed",
+    "regions_idle", "regions_repeated", "syncs_found", "syncs_missed", "syncs_unclear",
+    "symbols_demodulated", "bytes_demodulated", "codewords_decoded", "codewords_failed",
+    "codewords_cached", "bytes_erased", "bytes_corrected", "packets_combined", "packets_reassembled",
+    "messages", "frames_captured", "capture_dropped",
+};
+
+static const char *STAGE_NAMES[NUM_STAGES] = {
+    "convert", "flatten", "search", "demodulate", "decode", "analyze", "commit", "latency",
+};
+
+static std::atomic<uint64_t> counters[NUM_COUNTERS];
+static Histogram stages[NUM_STAGES];
+
+int Histogram::bucket(uint32_t value)
+{
+    if (value < HISTOGRAM_SUB) {
+        return value;
+    }
+
+    // the top HISTOGRAM_BITS + 1 bits select the bucket
+    int msb = 31 - __builtin_clz(value);
+    int shift = msb - HISTOGRAM_BITS;
+    return (shift + 1) * HISTOGRAM_SUB + (int)(value >> shift) - HISTOGRAM_SUB;
+}
+
+uint32_t Histogram::lowest(int bucket)
+{
+    if (bucket < HISTOGRAM_SUB) {
+        return bucket;
+    }
+    int shift = bucket / HISTOGRAM_SUB - 1;
+    return (uint32_t)(bucket % HISTOGRAM_SUB + HISTOGRAM_SUB) << shift;
+}
+
+void Histogram::record(uint32_t value)
+{
+    counts[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+void Histogram::reset()
+{
+    for (auto &count : counts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+    total.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+}
+
+uint32_t Histogram::min() const
+{
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (counts[i].load(std::memory_order_relaxed) > 0) {
+            return lowest(i);
+        }
+    }
+    return 0;
+}
+
+uint32_t Histogram::max() const
+{
+    for (int i = HISTOGRAM_BUCKETS - 1; i >= 0; i--) {
+        if (counts[i].load(std::memory_order_relaxed) > 0) {
+            return i + 1 < HISTOGRAM_BUCKETS ? lowest(i + 1) - 1 : UINT32_MAX;
+        }
+    }
+    return 0;
+}
+
+double Histogram::mean() const
+{
+    uint64_t n = count();
+    return n ? (double)sum.load(std::memory_order_relaxed) / n : 0;
+}
+
+uint32_t Histogram::percentile(double q) const
+{
+    // buckets are counted while others record, so use their own total
+    uint64_t n = 0;
+    for (auto &count : counts) {
+        n += count.load(std::memory_order_relaxed);
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(q * n + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += counts[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return i + 1 < HISTOGRAM_BUCKETS ? lowest(i + 1) - 1 : UINT32_MAX;
+        }
+    }
+    return max();
+}
+
+void metricsCount(Counter counter, uint64_t n)
+{
+    counters[counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+void metricsRecord(Stage stage, uint32_t us)
+{
+    stages[stage].record(us);
+}
+
+void metricsSnapshot(MetricsSnapshot &snapshot)
+{
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        snapshot.counters[i] = counters[i].load(std::memory_order_relaxed);
+    }
+    for (int i = 0; i < NUM_STAGES; i++) {
+        const Histogram &stage = stages[i];
+        StageSummary &summary = snapshot.stages[i];
+        summary.count = stage.count();
+        summary.min = stage.min();
+        summary.p50 = stage.percentile(0.50);
+        summary.p90 = stage.percentile(0.90);
+        summary.p99 = stage.percentile(0.99);
+        summary.max = stage.max();
+        summary.mean = stage.mean();
+    }
+}
+
+void metricsReset()
+{
+    for (auto &counter : counters) {
+        counter.store(0, std::memory_order_relaxed);
+    }
+    for (auto &stage : stages) {
+        stage.reset();
+    }
+}
+
+const char *counterName(int counter)
+{
+    return counter >= 0 && counter < NUM_COUNTERS ? COUNTER_NAMES[counter] : "unknown";
+}
+
+const char *stageName(int stage)
+{
+    return stage >= 0 && stage < NUM_STAGES ? STAGE_NAMES[stage] : "unknown";
+}
+
+std::string metricsReport()
+{
+    MetricsSnapshot snapshot;
+    metricsSnapshot(snapshot);
+
+    std::string report;
+    char line[160];
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        snprintf(line, sizeof(line), "%-20s %llu\n", counterName(i), (unsigned long long)snapshot.counters[i]);
+        report += line;
+    }
+    for (int i = 0; i < NUM_STAGES; i++) {
+        const StageSummary &s = snapshot.stages[i];
+        snprintf(line, sizeof(line), "%-20s n=%llu mean=%.1f min=%u p50=%u p90=%u p99=%u max=%u us\n",
+                 stageName(i), (unsigned long long)s.count, s.mean, s.min, s.p50, s.p90, s.p99, s.max);
+        report += line;
+    }
+    return report;
+}
@@ -0,0 +1,122 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+// stages whose latency is kept as a histogram, in us
+enum Stage {
+    STAGE_CONVERT = 0,      // RGB to Lab of a region
+    STAGE_FLATTEN,          // rows averaged into a flat frame
+    STAGE_SEARCH,           // active regions and preambles
+    STAGE_DEMODULATE,       // preambles refined and symbols sampled
+    STAGE_DECODE,           // slicing and Reed-Solomon, per codeword
+    STAGE_ANALYZE,          // everything a worker does for a region
+    STAGE_COMMIT,           // a frame applied to the receivers
+    STAGE_LATENCY,          // a frame from submission to commit
+    NUM_STAGES
+};
+
+enum Counter {
+    FRAMES_SUBMITTED = 0,
+    FRAMES_DROPPED,         // overwritten or skipped in the frame ring
+    FRAMES_SKIPPED,         // taken but left undecoded to meet the budget
+    FRAMES_DEGRADED,        // decoded only in part to meet the budget
+    REGIONS_ANALYZED,
+    REGIONS_IDLE,           // without any symbols
+    REGIONS_REPEATED,       // the same as in the previous frame, not analyzed
+    SYNCS_FOUND,
+    SYNCS_MISSED,           // active regions without a preamble
+    SYNCS_UNCLEAR,          // preambles whose edges could not be refined
+    SYMBOLS_DEMODULATED,
+    BYTES_DEMODULATED,      // codeword bytes sliced from symbols
+    CODEWORDS_DECODED,
+    CODEWORDS_FAILED,
+    CODEWORDS_CACHED,       // answered by an earlier decode of the same bytes
+    BYTES_ERASED,
+    BYTES_CORRECTED,
+    PACKETS_COMBINED,
+    PACKETS_REASSEMBLED,
+    MESSAGES,               // distinct messages delivered
+    FRAMES_CAPTURED,        // written to the capture, see capture.hpp
+    CAPTURE_DROPPED,        // left out of the capture, the writer fell behind
+    NUM_COUNTERS
+};
+
+// log-linear buckets as in HDR histograms: 2^HISTOGRAM_BITS linear buckets
+// per power of two, so any value is kept within 1/2^HISTOGRAM_BITS of itself
+#define HISTOGRAM_BITS    4
+#define HISTOGRAM_SUB     (1 << HISTOGRAM_BITS)
+#define HISTOGRAM_BUCKETS ((32 - HISTOGRAM_BITS + 1) * HISTOGRAM_SUB)
+
+// latency histogram any thread may record into without locking
+class Histogram {
+public:
+    void record(uint32_t value);
+    void reset();
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+    uint32_t min() const;
+    uint32_t max() const;
+    double mean() const;
+
+    // takes a quantile in [0, 1], returns the value below which that share
+    // of the recorded values fall
+    uint32_t percentile(double q) const;
+
+private:
+    static int bucket(uint32_t value);
+    static uint32_t lowest(int bucket);
+
+    std::atomic<uint32_t> counts[HISTOGRAM_BUCKETS] = {};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> sum{0};
+};
+
+// summary of a histogram at one point in time
+struct StageSummary {
+    uint64_t count;
+    uint32_t min, p50, p90, p99, max;
+    double mean;
+};
+
+struct MetricsSnapshot {
+    uint64_t counters[NUM_COUNTERS];
+    StageSummary stages[NUM_STAGES];
+};
+
+// takes a counter, adds n to it
+void metricsCount(Counter counter, uint64_t n = 1);
+
+// takes a stage, records one latency in us
+void metricsRecord(Stage stage, uint32_t us);
+
+// fills snapshot with every counter and stage
+void metricsSnapshot(MetricsSnapshot &snapshot);
+
+// clears every counter and stage
+void metricsReset();
+
+// returns the name of a counter or stage
+const char *counterName(int counter);
+const char *stageName(int stage);
+
+// returns a snapshot as text, a line per counter and per stage
+std::string metricsReport();
+
+// records the us between its construction and destruction into a stage
+class StageTimer {
+public:
+    explicit StageTimer(Stage stage) : stage(stage), start(std::chrono::steady_clock::now()) {}
+    ~StageTimer() {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        metricsRecord(stage, us.count());
+    }
+
+private:
+    Stage stage;
+    std::chrono::steady_clock::time_point start;
+};
+
+#endif // METRICS_HPP
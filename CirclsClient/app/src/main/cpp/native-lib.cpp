@@ -1,21 +1,20 @@
 #include <jni.h>
 #include <android/log.h>
-#include <opencv2/core/core.hpp>
-#include <opencv2/imgproc/imgproc.hpp>
-#include <iomanip>
-#include <sstream>
+#include <mutex>
+#include <vector>
 
 #define LOG_TAG    "native-lib"
 #define ALOG(...)  __android_log_print(ANDROID_LOG_INFO,LOG_TAG,__VA_ARGS__)
 
-#define DEBUG // avoid assert FindErrors
-#include "rs.hpp"
-#define NMSG 13
-#define NPAR 4
-RS::ReedSolomon<NMSG, NPAR> rs;
+// the JNI side of the receiver; decoding itself lives in the core library,
+// which builds without Android or OpenCV
+#include "cache.hpp"
+#include "metrics.hpp"
+#include "pipeline.hpp"
+#include "stream.hpp"
+#include "trace.hpp"
 
 using namespace std;
-using namespace cv;
 
 jint JNI_OnLoad(JavaVM* vm, void* reserved)
 {
@@ -28,212 +27,290 @@ jint JNI_OnLoad(JavaVM* vm, void* reserved)
 }
 
 
-// takes an OpenCV Matrix of 3D pixels
-// returns a single averaged row of 3D pixels
-void flattenMatrix(Mat &mat, int32_t flat[][3]) {
-    // get Mat properties
-    int rows = mat.rows;
-    int cols = mat.cols;
-    auto *data = (uint8_t *)mat.data;
+extern "C"
+JNIEXPORT jobjectArray JNICALL Java_edu_gmu_cs_CirclsClient_RxHandler_CreateRing(JNIEnv &env, jobject obj,
+                                                                          jint slots, jint capacity,
+                                                                          jboolean dropOldest) {
+    // the app closes the ring and collects every frame before it asks for
+    // another, so nothing refers to the old one
+    createRing(slots, capacity, dropOldest);
+
+    jclass cls = env.FindClass("java/nio/ByteBuffer");
+    jobjectArray buffers = env.NewObjectArray(ring->slots(), cls, nullptr);
+    for (int i = 0; buffers != nullptr && i < ring->slots(); i++) {
+        jobject buffer = env.NewDirectByteBuffer(ring->data(i), ring->capacity());
+        env.SetObjectArrayElement(buffers, i, buffer);
+        env.DeleteLocalRef(buffer);
+    }
+    env.DeleteLocalRef(cls);
+    return buffers;
+}
 
-    // initialize flat frame
-    memset(flat, 0, sizeof(int32_t) * cols * 3);
 
-    // for each row
-    for (int i = 0; i < rows; i++)
-    {
-        // sum up each col
-        for (int j = 0; j < cols; j++)
-        {
-            flat[cols - j - 1][0] += (*data++);
-            flat[cols - j - 1][1] += (*data++);
-            flat[cols - j - 1][2] += (*data++);
-        }
-    }
+extern "C"
+JNIEXPORT jint JNICALL Java_edu_gmu_cs_CirclsClient_RxHandler_BeginFrame(JNIEnv &env, jobject obj) {
+    int slot = ring->acquire();
+    countDrops();
+    return slot;
+}
 
-    // calculate col averages and adjust
-    for (int j = 0; j < cols; j++)
-    {
-        flat[j][0] /= rows;
-        flat[j][1] = flat[j][1] / rows - 128;
-        flat[j][2] = flat[j][2] / rows - 128;
-    }
+
+extern "C"
+JNIEXPORT void JNICALL Java_edu_gmu_cs_CirclsClient_RxHandler_EndFrame(JNIEnv &env, jobject obj, jint slot,
+                                                               jint width, jint height, jlong timestamp) {
+    ring->publish(slot, width, height, timestamp);
 }
 
 
-// takes symbol storage, a flat frame of pixels, and the number of pixels
-int detectSymbols( uint8_t symbols[][2], int32_t frame[][3], int pixels )
-{
-    std::stringstream ss;
-    int count = 0;          // symbol index
-    int width = 0;
-    char p = ' ';           // previous symbol
-
-    // convert Lab numbers to 01RGBY representation
-    for (int i = 0; i < pixels; i++)
-    {
-        int L = frame[i][0];
-        int a = frame[i][1];
-        int b = frame[i][2];
-        char c;
-
-        // +L = white, +a = red; -a = green; -b = blue; +b = yellow;
-        if (L < 20) {
-            c = '0';
-        } else if (abs(a) < 30 && abs(b) < 30) {
-            c = '1';
-        } else {
-            if (abs(a) > abs(b)) {
-                c = (a < 0) ? 'G' : 'R';
-            } else {
-                c = (b < 0) ? 'B' : 'Y';
-            }
-        }
+extern "C"
+JNIEXPORT void JNICALL Java_edu_gmu_cs_CirclsClient_RxHandler_CloseRing(JNIEnv &env, jobject obj) {
+    ring->close();
+}
 
-        ss << '(' << frame[i][0] << ',' << frame[i][1] << ',' << frame[i][2] << ' ' << c << ')';
-
-        // same as last pixel?
-        if (c != p)
-        {
-            // store previous symbol
-            symbols[count][0] = p;
-            symbols[count][1] = width;
-            count++;
-
-            // start tracking new symbol
-            p = c;
-            width = 1;
-        } else {
-            width++;
-        }
+
+extern "C"
+JNIEXPORT jint JNICALL Java_edu_gmu_cs_CirclsClient_RxHandler_TakeFrame(JNIEnv &env, jobject obj) {
+    return ring->take();
+}
+
+
+extern "C"
+JNIEXPORT jboolean JNICALL Java_edu_gmu_cs_CirclsClient_RxHandler_FramePending(JNIEnv &env, jobject obj) {
+    return ring->pending() ? JNI_TRUE : JNI_FALSE;
+}
+
+
+extern "C"
+JNIEXPORT jint JNICALL Java_edu_gmu_cs_CirclsClient_RxHandler_EngineDepth(JNIEnv &env, jobject obj) {
+    return engineDepth;
+}
+
+
+extern "C"
+JNIEXPORT void JNICALL Java_edu_gmu_cs_CirclsClient_RxHandler_DropFrames(JNIEnv &env, jobject obj) {
+    ring->drop();
+    countDrops();
+    ALOG("Frames dropped: %llu", (unsigned long long)ring->dropped());
+}
+
+
+extern "C"
+JNIEXPORT void JNICALL Java_edu_gmu_cs_CirclsClient_RxHandler_SubmitFrame(JNIEnv &env, jobject obj, jint slot) {
+    submitFrame(slot);
+}
+
+
+extern "C"
+JNIEXPORT jint JNICALL Java_edu_gmu_cs_CirclsClient_RxHandler_CollectReports(JNIEnv &env, jobject obj,
+                                                                     jobject reports, jboolean wait) {
+    auto *buffer = (uint8_t *)env.GetDirectBufferAddress(reports);
+    jlong capacity = env.GetDirectBufferCapacity(reports);
+    if (buffer == nullptr || capacity < 0) {
+        return -1;
     }
 
-    ALOG("Frame: %s", ss.str().c_str());
-    return count;
+    size_t size = 0;
+    bool collected = collectFrame([&](const FrameResult &result) {
+        size = packResult(result, buffer, capacity);
+    }, wait);
+    return collected ? (jint)size : -1;
 }
 
 
-// convert symbols into bits and return as bytes
-int demodulate(uint8_t data[], int dataLen, uint8_t symbols[][2], int symbolLen)
-{
-    int i = 7;         // symbol index
-    int j = 0;         // data index
-    int k = 0;         // bit index
-    int width = INT_MAX;
-
-    // process remaining symbols
-    while (i < symbolLen && j < dataLen)
-    {
-        uint8_t b = 0;
-        switch (symbols[i][0]) {
-            default:
-                // look for sync sequence
-                if (width == INT_MAX
-                    && symbols[i - 7][0] == '1'
-                    && symbols[i - 6][0] == '0'
-                    && symbols[i - 5][0] == '1'
-                    && symbols[i - 4][0] == '0'
-                    && symbols[i - 3][0] == '1'
-                    && symbols[i - 2][0] == '0'
-                    && symbols[i - 1][0] == '1'
-                    && symbols[i][0] == '0')
-                {
-                    width = (symbols[i - 7][1] + symbols[i - 5][1] + symbols[i - 3][1] + symbols[i - 1][1]) * 3 / 16;
-                    ALOG("Symbol Width: %d", width);
-                }
-
-                // non-data symbol
-                i++;
-                continue;
-            case 'R':
-                b = 0b00;
-                break;
-            case 'G':
-                b = 0b01;
-                break;
-            case 'B':
-                b = 0b10;
-                break;
-            case 'Y':
-                b = 0b11;
-                break;
-        }
+extern "C"
+JNIEXPORT void JNICALL Java_edu_gmu_cs_CirclsClient_RxHandler_SetLatencyBudget(JNIEnv &env, jobject obj,
+                                                                       jint us) {
+    setLatencyBudget(us > 0 ? us : 0);
+}
 
-        if (symbols[i][1] >= width) {
-            // new byte
-            if (k == 0) {
-                data[j] = 0;
-            }
 
-            // insert data symbol
-            data[j] |= b << k;
+extern "C"
+JNIEXPORT jbyteArray JNICALL Java_edu_gmu_cs_CirclsClient_RxHandler_DumpTrace(JNIEnv &env, jobject obj) {
+    vector<uint8_t> dump(traceDumpSize());
+    size_t len = traceDump(dump.data(), dump.size());
 
-            // update bit index
-            k = (k + 2) % 8;
+    jbyteArray array = env.NewByteArray(len);
+    if (array != nullptr) {
+        env.SetByteArrayRegion(array, 0, len, (const jbyte *)dump.data());
+    }
+    return array;
+}
 
-            // next byte?
-            if (k == 0) {
-                j++;
-            }
 
-            symbols[i][1] -= width;
-        } else {
-            // ignore symbols that are too small
-            i++;
-        }
+extern "C"
+JNIEXPORT jboolean JNICALL Java_edu_gmu_cs_CirclsClient_RxHandler_StartCapture(JNIEnv &env, jobject obj,
+                                                                      jstring path, jboolean runs) {
+    const char *chars = env.GetStringUTFChars(path, nullptr);
+    if (chars == nullptr) {
+        return JNI_FALSE;
     }
 
-    return j;
+    bool ok = startCapture(chars, runs);
+    ALOG("Capture %s: %s", ok ? "started" : "failed", chars);
+    env.ReleaseStringUTFChars(path, chars);
+    return ok ? JNI_TRUE : JNI_FALSE;
+}
+
+
+extern "C"
+JNIEXPORT void JNICALL Java_edu_gmu_cs_CirclsClient_RxHandler_StopCapture(JNIEnv &env, jobject obj) {
+    stopCapture();
+}
+
+
+// values per stage in a metrics snapshot: count, min, p50, p90, p99, max
+#define STAGE_VALUES 6
+
+extern "C"
+JNIEXPORT jlongArray JNICALL Java_edu_gmu_cs_CirclsClient_RxHandler_MetricsSnapshot(JNIEnv &env, jobject obj) {
+    MetricsSnapshot snapshot;
+    metricsSnapshot(snapshot);
+
+    // every counter, then STAGE_VALUES per stage, in the order of their enums
+    jlong values[NUM_COUNTERS + NUM_STAGES * STAGE_VALUES];
+    jlong *out = values;
+    for (auto counter : snapshot.counters) {
+        *out++ = counter;
+    }
+    for (auto &stage : snapshot.stages) {
+        *out++ = stage.count;
+        *out++ = stage.min;
+        *out++ = stage.p50;
+        *out++ = stage.p90;
+        *out++ = stage.p99;
+        *out++ = stage.max;
+    }
+
+    jlongArray array = env.NewLongArray(out - values);
+    if (array != nullptr) {
+        env.SetLongArrayRegion(array, 0, out - values, values);
+    }
+    return array;
+}
+
+
+extern "C"
+JNIEXPORT jstring JNICALL Java_edu_gmu_cs_CirclsClient_RxHandler_MetricsReport(JNIEnv &env, jobject obj) {
+    return env.NewStringUTF(metricsReport().c_str());
+}
+
+
+extern "C"
+JNIEXPORT jbyteArray JNICALL Java_edu_gmu_cs_CirclsClient_RxHandler_SaveCalibration(JNIEnv &env, jobject obj,
+                                                                         jint width, jint height) {
+    uint8_t blob[sizeof(CacheBlob)];
+    size_t len = saveCalibration(blob, sizeof(blob), width, height);
+
+    jbyteArray array = env.NewByteArray(len);
+    if (array != nullptr) {
+        env.SetByteArrayRegion(array, 0, len, (const jbyte *)blob);
+    }
+    return array;
 }
 
 
 extern "C"
-JNIEXPORT jcharArray JNICALL Java_edu_gmu_cs_CirclsClient_RxHandler_FrameProcessor(JNIEnv &env, jobject obj,
-                                                                           jint width, jint height, jobject pixels) {
-    uint8_t data[NMSG+NPAR];
-    int num_decoded = 0;
+JNIEXPORT jboolean JNICALL Java_edu_gmu_cs_CirclsClient_RxHandler_LoadCalibration(JNIEnv &env, jobject obj,
+                                                                         jbyteArray array, jint width, jint height) {
+    jsize len = env.GetArrayLength(array);
+    if (len != sizeof(CacheBlob)) {
+        return JNI_FALSE;
+    }
+
+    uint8_t blob[sizeof(CacheBlob)];
+    env.GetByteArrayRegion(array, 0, len, (jbyte *)blob);
+
+    bool ok = loadCalibration(blob, len, width, height);
+
+    std::lock_guard<std::mutex> lock(stateLock);
+    Receiver &rx = receivers[0];
+    ALOG("Calibration %s: width %.2f, roi (%d,%d)-(%d,%d)", ok ? "loaded" : "rejected",
+         rx.symbolWidth, rx.roi.left, rx.roi.top, rx.roi.right, rx.roi.bottom);
+    return ok ? JNI_TRUE : JNI_FALSE;
+}
 
-    if (width > 0 && height > 0) {
-        // build matrix around RGBA frame
-        Mat matRGB(height, width, CV_8UC4, env.GetDirectBufferAddress(pixels));
 
-        // convert frame to Lab color-space
-        Mat matLab;
-        cvtColor(matRGB, matLab, COLOR_RGB2Lab);
-        matRGB.release();
+// stream decoder owned by a Java StreamDecoder; it classifies by its own copy
+// of the colors learned so far, so it decodes without holding stateLock
+struct StreamHandle {
+    vector<PacketReport> packets;   // messages decoded during a push or flush
+    ColorCalibrator colors;
+    StreamDecoder decoder;
 
-        // flatten frame
-        int num_pixels = width;
-        int32_t frame[num_pixels][3];
-        flattenMatrix(matLab, frame);
-        matLab.release();
+    explicit StreamHandle(const ColorCalibrator &calibrator)
+        : colors(calibrator), decoder(colors, [this](const uint8_t *data, int len) {
+            Sync sync;
+            sync.slot = decoder.slot();
+            appendPacket(packets, makeReport(len == NMSG ? PACKET_DECODED : PACKET_LONG, data, len, 0, 0, sync));
+        }) {}
+};
 
-        // detect symbols
-        uint8_t symbols[num_pixels][2];
-        int num_symbols = detectSymbols(symbols, frame, num_pixels);
 
-        // demodulate
-        int num_encoded = demodulate(data, NMSG+NPAR, symbols, num_symbols);
+// takes a stream and the Java StreamDecoder owning it
+// hands the packets it decoded to onPacket
+static void deliverPackets(JNIEnv &env, jobject obj, StreamHandle *stream)
+{
+    if (stream->packets.empty()) {
+        return;
+    }
 
-        // decode if we have a full message
-        if (num_encoded == NMSG+NPAR) {
-            num_decoded = rs.Decode(data, data) ? 0 : NMSG;
+    jclass cls = env.GetObjectClass(obj);
+    jmethodID onPacket = env.GetMethodID(cls, "onPacket", "([C)V");
+    for (auto &report : stream->packets) {
+        jcharArray text = env.NewCharArray(report.length);
+        if (text != nullptr) {
+            vector<jchar> buf(report.data, report.data + report.length);
+            env.SetCharArrayRegion(text, 0, buf.size(), buf.data());
+            env.CallVoidMethod(obj, onPacket, text);
+            env.DeleteLocalRef(text);
         }
-        ALOG("Encoded: %d, Decoded: %d, Id: %d, Message: %.*s %x %x %x %x",
-             num_encoded, num_decoded,
-             data[0], NMSG - 1, (data + 1),
-             data[num_encoded - 3], data[num_encoded - 2], data[num_encoded - 1], data[num_encoded]);
     }
+    env.DeleteLocalRef(cls);
+    stream->packets.clear();
+}
+
+
+extern "C"
+JNIEXPORT jlong JNICALL Java_edu_gmu_cs_CirclsClient_StreamDecoder_Create(JNIEnv &env, jobject obj) {
+    std::lock_guard<std::mutex> lock(stateLock);
+    return (jlong) new StreamHandle(receivers[0].calibrator);
+}
 
-    // return text
-    jcharArray message = env.NewCharArray(num_decoded);
-    if (message != nullptr) {
-        jchar buf[num_decoded];
-        for (int i = 0; i < num_decoded; i++) {
-            buf[i] = data[i];
+
+extern "C"
+JNIEXPORT void JNICALL Java_edu_gmu_cs_CirclsClient_StreamDecoder_Push(JNIEnv &env, jobject obj, jlong handle,
+                                                                       jobject columns, jint count) {
+    auto *stream = (StreamHandle *)handle;
+    auto *lab = (uint8_t *)env.GetDirectBufferAddress(columns);
+    jlong capacity = env.GetDirectBufferCapacity(columns);
+    if (lab == nullptr || count <= 0 || capacity < (jlong)count * 3) {
+        return;
+    }
+
+    // 8 bit Lab as OpenCV converts it, a and b offset by 128
+    int32_t flat[64][3];
+    for (int i = 0; i < count; i += 64) {
+        int n = std::min(count - i, 64);
+        for (int j = 0; j < n; j++, lab += 3) {
+            flat[j][0] = lab[0];
+            flat[j][1] = lab[1] - 128;
+            flat[j][2] = lab[2] - 128;
         }
-        env.SetCharArrayRegion(message, 0, num_decoded, buf);
+        stream->decoder.push(flat, n);
     }
+    deliverPackets(env, obj, stream);
+}
+
 
-    return message;
+extern "C"
+JNIEXPORT void JNICALL Java_edu_gmu_cs_CirclsClient_StreamDecoder_Flush(JNIEnv &env, jobject obj, jlong handle) {
+    auto *stream = (StreamHandle *)handle;
+    stream->decoder.flush();
+    deliverPackets(env, obj, stream);
+}
+
+
+extern "C"
+JNIEXPORT void JNICALL Java_edu_gmu_cs_CirclsClient_StreamDecoder_Destroy(JNIEnv &env, jobject obj, jlong handle) {
+    delete (StreamHandle *)handle;
 }
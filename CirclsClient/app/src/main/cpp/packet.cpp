@@ -0,0 +1,138 @@
+#include "packet.hpp"
+#include "demod.hpp"
+#include "hash.hpp"
+#include "metrics.hpp"
+#include <math.h>
+#include <string.h>
+
+#define DEBUG // avoid assert FindErrors
+#include "rs.hpp"
+
+// the decoders keep their working memory in the object
+static thread_local RS::ReedSolomon<NMSG, NPAR> rs;
+static thread_local RS::ReedSolomon<NMSG_LONG, NPAR_LONG> rsLong;
+
+#define CODEWORD_CACHE   8      // decode results each thread remembers
+#define MAX_FALSE_ACCEPT 0.01f  // chance of a random word decoding as it
+                                // did that an accepted correction may have
+
+// how one sliced codeword decoded; the LED repeats a packet until its id
+// changes, so the same bytes and erasures keep coming back
+struct CachedCodeword {
+    uint64_t key = 0;       // fingerprint of raw and erasures, 0 if unused
+    uint32_t used = 0;      // when it last answered, to replace the oldest
+    int len = 0;
+    int numErasures = 0;
+    uint8_t raw[NMSG_LONG+NPAR_LONG];
+    uint8_t erasures[NMSG_LONG+NPAR_LONG];
+    bool decoded = false;
+    int numCorrected = 0;
+    uint8_t codeword[NMSG_LONG+NPAR_LONG];
+};
+
+static thread_local CachedCodeword codewords[CODEWORD_CACHE];
+static thread_local uint32_t codewordClock = 0;
+
+// takes sliced bytes, the codeword they corrected to, their erasures and the
+// number of parity bytes
+// returns the chance that a random word decodes with as few bytes changed
+// outside the erasures: the words that close to one codeword over the words
+// the parity left by the erasures tells apart; erasing every parity byte
+// makes any word decode, erasing all but one or two leaves a single error
+// corrected with a chance of several percent
+static double falseAccept(const uint8_t raw[], const uint8_t codeword[], int len, const uint8_t erasures[],
+                          int numErasures, int npar)
+{
+    int errors = 0;
+    for (int i = 0, e = 0; i < len; i++) {
+        if (e < numErasures && erasures[e] == i) {
+            e++;
+        } else {
+            errors += codeword[i] != raw[i];
+        }
+    }
+
+    double words = 0, term = 1;     // term is C(n, i) * 255^i
+    int n = len - numErasures;
+    for (int i = 0; i <= errors; i++) {
+        words += term;
+        term *= (double)(n - i) / (i + 1) * 255;
+    }
+    return words / pow(256, npar - numErasures);
+}
+
+// takes sliced bytes and their erasures
+// returns the cache entry holding them, otherwise the one to replace
+static CachedCodeword &findCodeword(uint64_t key, const uint8_t raw[], int len, const uint8_t erasures[],
+                                    int numErasures)
+{
+    CachedCodeword *oldest = &codewords[0];
+    for (auto &entry : codewords) {
+        if (entry.key == key && entry.len == len && entry.numErasures == numErasures
+            && memcmp(entry.raw, raw, len) == 0 && memcmp(entry.erasures, erasures, numErasures) == 0)
+        {
+            return entry;
+        }
+        if (entry.used < oldest->used) {
+            oldest = &entry;
+        }
+    }
+    return *oldest;
+}
+
+bool decodeSymbols(const float soft[][3], int symbols, const ColorCalibrator &colors, uint8_t data[],
+                   int &numErasures, int &numCorrected)
+{
+    StageTimer timer(STAGE_DECODE);
+    uint8_t erasures[NMSG_LONG+NPAR_LONG];
+    int len = slice(data, soft, symbols, colors, erasures, numErasures);
+    numCorrected = 0;
+    metricsCount(BYTES_DEMODULATED, len);
+    metricsCount(BYTES_ERASED, numErasures);
+
+    // answer a repeat from the cache
+    uint64_t key = fingerprint(erasures, numErasures, fingerprint(data, len)) | 1;
+    CachedCodeword &entry = findCodeword(key, data, len, erasures, numErasures);
+    entry.used = ++codewordClock;
+    if (entry.key == key) {
+        metricsCount(CODEWORDS_CACHED);
+    } else {
+        entry.key = key;
+        entry.len = len;
+        entry.numErasures = numErasures;
+        memcpy(entry.raw, data, len);
+        memcpy(entry.erasures, erasures, numErasures);
+
+        // correct the message, then re-encode it to see what changed
+        uint8_t *codeword = entry.codeword;
+        int npar = symbols == NSYM_LONG ? NPAR_LONG : NPAR;
+        if (symbols == NSYM_LONG) {
+            entry.decoded = numErasures < NPAR_LONG && rsLong.Decode(data, codeword, erasures, numErasures) == 0;
+            if (entry.decoded) {
+                rsLong.EncodeBlock(codeword, codeword + NMSG_LONG);
+            }
+        } else {
+            entry.decoded = numErasures < NPAR && rs.Decode(data, codeword, erasures, numErasures) == 0;
+            if (entry.decoded) {
+                rs.EncodeBlock(codeword, codeword + NMSG);
+            }
+        }
+        entry.decoded = entry.decoded
+                        && falseAccept(data, codeword, len, erasures, numErasures, npar) < MAX_FALSE_ACCEPT;
+
+        entry.numCorrected = 0;
+        for (int i = 0; entry.decoded && i < len; i++) {
+            entry.numCorrected += codeword[i] != data[i];
+        }
+    }
+
+    if (!entry.decoded) {
+        metricsCount(CODEWORDS_FAILED);
+        return false;
+    }
+    numCorrected = entry.numCorrected;
+    memcpy(data, entry.codeword, len);
+    metricsCount(CODEWORDS_DECODED);
+    metricsCount(BYTES_CORRECTED, numCorrected);
+    return true;
+}
@@ -0,0 +1,52 @@
+#ifndef PACKET_HPP
+#define PACKET_HPP
+#include <stdint.h>
+#include "calibrate.hpp"
+
+// short packets fit within a frame
+#define NMSG 13
+#define NPAR 4
+#define NSYM ((NMSG+NPAR) * 4)  // data symbols per packet
+
+// long packets span several frames
+#define NMSG_LONG 48
+#define NPAR_LONG 16
+#define NSYM_LONG ((NMSG_LONG+NPAR_LONG) * 4)
+
+#define SLOT_NS 150000          // transmitter slot width, WIDTH in LedTest
+
+// how a packet came out of decoding
+enum PacketStatus {
+    PACKET_DECODED = 0,     // short packet, decoded on its own
+    PACKET_COMBINED,        // short packet, decoded by combining repeats
+    PACKET_LONG,            // long packet, decoded within one frame
+    PACKET_REASSEMBLED,     // long packet, decoded across frames
+    PACKET_FAILED,          // too many errors to correct
+};
+
+// one decode attempt as reported to the app
+struct PacketReport {
+    uint8_t region = 0;     // transmitter the packet came from
+    uint8_t status = PACKET_FAILED;
+    uint8_t length = 0;     // message bytes in data, id included, 0 if failed
+    uint8_t erasures = 0;   // bytes erased before correction
+    uint8_t corrected = 0;  // codeword bytes the correction changed
+    int32_t sync = -1;      // first pixel of the preamble, -1 if carried over
+    float slot = 0;         // pixels per symbol slot
+    uint8_t data[NMSG_LONG];
+};
+
+// takes the soft symbols of a packet, NSYM or NSYM_LONG of them
+// slices them and corrects the bytes with the matching code, erasing bytes
+// whose symbols are not colors; returns true and the corrected codeword in
+// data if it decodes and a random word would decode with as few changes
+// less than 1% of the time, which rejects corrections that erasures left
+// little parity for; the number of erasures is stored in numErasures and
+// the number of bytes that differ from the re-encoded codeword in
+// numCorrected
+// each thread has its own decoders and remembers the last codewords it
+// decoded, so regions can decode in parallel and repeats skip the decoder
+bool decodeSymbols(const float soft[][3], int symbols, const ColorCalibrator &colors, uint8_t data[],
+                   int &numErasures, int &numCorrected);
+
+#endif // PACKET_HPP
@@ -0,0 +1,1105 @@
+#include "pipeline.hpp"
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <thread>
+#include "arena.hpp"
+#include "cache.hpp"
+#include "demod.hpp"
+#include "engine.hpp"
+#include "lab.hpp"
+#include "metrics.hpp"
+#include "schedule.hpp"
+#include "trace.hpp"
+
+// row subsampling of the reduction, adapted from the stripe SNR
+#define SNR_LOW   250.0f    // halve the row step below this
+#define SNR_HIGH  1000.0f   // double the row step above this
+#define MAX_ROW_STEP 16
+
+Receiver receivers[MAX_RECEIVERS];
+int regionAge = 0;                      // frames since the last full detection
+bool regionLost = false;                // a region lost its stripes since then
+bool detecting = false;                 // a frame in flight detects regions
+int detections = 0;                     // full detections committed
+FrameScheduler scheduler;               // how much of each frame to decode
+std::mutex stateLock;
+
+FrameRing *ring = nullptr;
+std::unique_ptr<CaptureWriter> capture; // records committed frames, guarded by stateLock
+std::atomic<uint64_t> dropsCounted{0};  // ring drops already added to the metrics
+
+using namespace std;
+using namespace std::chrono;
+
+// adds the microseconds between its construction and destruction to total
+struct Stopwatch {
+    uint32_t &total;
+    steady_clock::time_point start = steady_clock::now();
+
+    explicit Stopwatch(uint32_t &total) : total(total) {}
+    ~Stopwatch() { total += duration_cast<microseconds>(steady_clock::now() - start).count(); }
+};
+
+
+// takes rows of cols Lab pixels, the index of the first within the region and
+// the running sums of the region
+// adds each row to flat, and the luminance of the odd rows to odd
+void accumulateRows(const uint8_t *lab, int rows, int cols, int first, int32_t flat[][3], int32_t odd[])
+{
+    // for each row
+    for (int i = 0; i < rows; i++)
+    {
+        const uint8_t *data = lab + (size_t)i * cols * 3;
+
+        // sum up each col
+        for (int j = 0; j < cols; j++)
+        {
+            flat[cols - j - 1][0] += (*data++);
+            flat[cols - j - 1][1] += (*data++);
+            flat[cols - j - 1][2] += (*data++);
+        }
+
+        // luminance of the odd rows, kept apart to measure noise
+        if ((first + i) & 1) {
+            data = lab + (size_t)i * cols * 3;
+            for (int j = 0; j < cols; j++) {
+                odd[cols - j - 1] += data[j * 3];
+            }
+        }
+    }
+}
+
+
+// takes the running sums of a region of rows by cols pixels
+// averages them into a single row of 3D pixels, returns the stripe SNR
+float finishFlat(int32_t flat[][3], const int32_t odd[], int rows, int cols)
+{
+    // stripes are uniform along the rows, so the even/odd difference is noise
+    float snr = 0;
+    int numOdd = rows / 2;
+    int numEven = rows - numOdd;
+    if (numOdd > 0) {
+        float sum = 0, sumSq = 0, noise = 0;
+        for (int j = 0; j < cols; j++) {
+            float o = (float)odd[j] / numOdd;
+            float e = (float)(flat[j][0] - odd[j]) / numEven;
+            float s = (e + o) / 2;
+            float d = (e - o) / 2;
+            sum += s;
+            sumSq += s * s;
+            noise += d * d;
+        }
+        float mean = sum / cols;
+        float signal = sumSq / cols - mean * mean;
+        noise /= cols;
+        snr = signal / (noise > 0.01f ? noise : 0.01f);
+    }
+
+    // calculate col averages and adjust
+    for (int j = 0; j < cols; j++)
+    {
+        flat[j][0] /= rows;
+        flat[j][1] = flat[j][1] / rows - 128;
+        flat[j][2] = flat[j][2] / rows - 128;
+    }
+
+    return snr;
+}
+
+
+// takes run storage, a flat frame of pixels, and the number of pixels
+int detectSymbols( Runs &runs, int32_t frame[][3], int pixels, const ColorCalibrator &colors )
+{
+    // convert Lab numbers to 01RGBY runs
+    ArenaScope scope;
+    uint8_t *classes = scope.arena.alloc<uint8_t>(pixels);
+    colors.classify(frame, pixels, classes);
+    int count = extractRuns(classes, pixels, runs);
+
+    TRACE(2, TRACE_RUNS, count, pixels);
+    return count;
+}
+
+
+PacketReport makeReport(int status, const uint8_t *data, int length, int erasures, int corrected,
+                        const Sync &sync)
+{
+    PacketReport report;
+    report.status = status;
+    report.erasures = erasures;
+    report.corrected = corrected;
+    report.sync = sync.begin;
+    report.slot = sync.slot;
+    if (status != PACKET_FAILED) {
+        report.length = length;
+        memcpy(report.data, data, length);
+    }
+    return report;
+}
+
+
+bool appendPacket(vector<PacketReport> &reports, PacketReport report)
+{
+    if (report.status == PACKET_FAILED) {
+        reports.push_back(report);
+        return false;
+    }
+
+    // unused message bytes are sent as zeros
+    while (report.length > 1 && report.data[report.length - 1] == 0) {
+        report.length--;
+    }
+
+    // the same packet is usually repeated within a frame
+    for (auto &other : reports) {
+        if (other.length == report.length && memcmp(other.data, report.data, report.length) == 0) {
+            return false;
+        }
+    }
+
+    TRACE(1, TRACE_MESSAGE, report.region, report.data[0], report.length);
+    metricsCount(MESSAGES);
+    reports.push_back(report);
+    return true;
+}
+
+
+// takes a receiver and the soft symbols of a long packet carried across frames
+// reports it to the receiver's packets, returns true if it decoded a new message
+bool decodeLong(Receiver &rx, const float soft[][3])
+{
+    uint8_t data[NMSG_LONG+NPAR_LONG];
+    int num_erasures, num_corrected;
+    bool decoded = decodeSymbols(soft, NSYM_LONG, rx.calibrator, data, num_erasures, num_corrected);
+    TRACE(2, TRACE_DECODE, decoded ? PACKET_REASSEMBLED : PACKET_FAILED, num_erasures, num_corrected);
+    if (decoded) {
+        metricsCount(PACKETS_REASSEMBLED);
+    }
+
+    Sync carried;
+    carried.slot = rx.symbolWidth;
+    return appendPacket(rx.packets, makeReport(decoded ? PACKET_REASSEMBLED : PACKET_FAILED, data, NMSG_LONG,
+                                               num_erasures, num_corrected, carried));
+}
+
+
+// one preamble of a region as a worker demodulated it
+struct Demodulated {
+    Sync sync;                  // preamble, refined if refined is set
+    bool refined = false;
+    Sync next;                  // symbol clock after the last symbol
+    int end = 0;                // first pixel after the last symbol
+    int symbols = 0;            // soft symbols sampled
+    float soft[NSYM_LONG][3];
+    int status = PACKET_FAILED; // how it decoded on its own
+    int length = 0;             // message bytes in data, 0 unless it decoded
+    int erasures = 0;
+    int corrected = 0;
+    uint8_t data[NMSG_LONG+NPAR_LONG];
+};
+
+// one region of a frame on its way through the engine; the inputs are copied
+// from its receiver when the frame is submitted, the outputs are applied to
+// the receiver when the frame is committed
+struct RegionWork {
+    int receiver = 0;           // index of the receiver
+    unsigned generation = 0;    // the receiver's generation at submission
+    Roi rect;                   // part of the frame reduced, followed first if valid
+    bool follow = false;        // rect is the receiver's region, followed into the frame
+    uint64_t fingerprint = 0;   // the receiver's, then the region's in this frame
+    int rowStep = 1;
+    float symbolWidth = 0;
+    ColorCalibrator colors;     // updated with the region's own packets
+    bool predicted = false;     // windows hold a trusted prediction
+    vector<Window> windows;
+    bool coarse = false;        // rows skipped beyond rowStep, short packets only
+    const CaptureRegion *replay = nullptr;  // recorded reduction decoded instead of the frame
+    bool captureRuns = false;   // keep the symbol runs for the capture
+
+    bool lost = false;          // the followed region no longer holds stripes
+    bool repeated = false;      // reduces as last time, not analyzed
+    int rows = 0;               // rows reduced
+    float snr = 0;
+    uint32_t analyzeUs = 0;     // time spent analyzing
+    bool idle = false;          // no symbols in the region
+    vector<int32_t> flat;       // flat frame, three values per pixel
+    Runs runs;                  // symbol runs of the flat frame, if captured
+    vector<Sync> syncs;         // preambles found, in frame order
+    vector<Demodulated> packets;// one per preamble
+};
+
+// frame submitted to the engine
+struct FrameJob {
+    int slot;                   // ring slot holding the pixels until committed
+    const uint8_t *rgba;
+    int width;
+    int height;
+    int64_t timestamp;
+    steady_clock::time_point submitted;
+    Tier tier;
+    uint32_t predictedUs;       // latency the scheduler expected
+    int numRegions;
+    RegionWork regions[MAX_RECEIVERS];
+    int detections;             // full detections committed at submission
+    bool detect;                // one more task detects every region
+    uint32_t detectUs;          // time the worker spent detecting
+    int numFound;
+    Roi found[MAX_RECEIVERS];   // regions detected, strongest first
+};
+
+// rows converted to Lab at once
+#define TILE_ROWS 16
+
+// storage a worker reuses from frame to frame
+struct Scratch {
+    vector<Window> regions;
+    Runs runs;
+};
+
+
+// takes a submitted frame, one of its regions and its flat frame, zeroed
+// reduces every rowStep-th row of the region into the flat frame
+void reduceRegion(const FrameJob &job, RegionWork &work, int32_t frame[][3])
+{
+    const Roi &rect = work.rect;
+    work.rows = (rect.height() + work.rowStep - 1) / work.rowStep;
+    const uint8_t *rgba = job.rgba + ((size_t)rect.top * job.width + rect.left) * 4;
+    size_t stride = (size_t)job.width * 4 * work.rowStep;
+
+    // convert sampled rows to Lab color-space and flatten them a tile at a
+    // time, so the Lab rows stay in cache whatever the resolution
+    int pixels = rect.width();
+    ArenaScope scope;
+    int32_t *odd = scope.arena.alloc<int32_t>(pixels, true);
+    uint8_t *lab = scope.arena.alloc<uint8_t>((size_t)TILE_ROWS * pixels * 3);
+    uint32_t convertUs = 0, flattenUs = 0;
+    for (int first = 0; first < work.rows; first += TILE_ROWS) {
+        int rows = min(TILE_ROWS, work.rows - first);
+        {
+            Stopwatch convert(convertUs);
+            for (int i = 0; i < rows; i++) {
+                rgbaToLab(rgba + (first + i) * stride, pixels, lab + (size_t)i * pixels * 3);
+            }
+        }
+        Stopwatch flatten(flattenUs);
+        accumulateRows(lab, rows, pixels, first, frame, odd);
+    }
+    work.snr = finishFlat(frame, odd, work.rows, pixels);
+    metricsRecord(STAGE_CONVERT, convertUs);
+    metricsRecord(STAGE_FLATTEN, flattenUs);
+}
+
+
+// takes a submitted frame and one of its regions
+// follows the receiver's region into the frame, returns false if it lost its
+// stripes or reduces as it did last time, so there is nothing to analyze
+bool locateRegion(const FrameJob &job, RegionWork &work)
+{
+    Stopwatch watch(work.analyzeUs);
+    if (work.replay != nullptr) {
+        return true;
+    }
+    if (work.follow && !followRoi(job.rgba, job.width, job.height, work.rect)) {
+        work.lost = true;
+        return false;
+    }
+
+    // a region that reduces the same as last time holds nothing new
+    uint64_t print = fingerprintRoi(job.rgba, job.width, work.rect);
+    work.repeated = print == work.fingerprint;
+    work.fingerprint = print;
+    return !work.repeated;
+}
+
+
+// takes a submitted frame that detects regions
+// finds every region holding LED stripes, applied once the frame is committed
+void detectFrame(FrameJob &job)
+{
+    Stopwatch watch(job.detectUs);
+    job.numFound = detectRois(job.rgba, job.width, job.height, job.found, MAX_RECEIVERS);
+    int tracked = count_if(job.regions, job.regions + job.numRegions, [](const RegionWork &work) {
+        return work.follow;
+    });
+    TRACE(1, TRACE_DETECT, job.numFound, tracked);
+}
+
+
+// takes a worker's scratch, a submitted frame and one of its regions
+// reduces the region to a flat frame, or takes the one recorded in a capture,
+// then finds, demodulates and decodes every packet in it that needs nothing
+// learned from earlier frames
+void analyzeRegion(Scratch &scratch, const FrameJob &job, RegionWork &work)
+{
+    Stopwatch watch(work.analyzeUs);
+    StageTimer timer(STAGE_ANALYZE);
+    metricsCount(REGIONS_ANALYZED);
+
+    int pixels = work.rect.width();
+    work.flat.assign((size_t)pixels * 3, 0);
+    auto frame = (int32_t (*)[3])work.flat.data();
+    if (work.replay != nullptr) {
+        captureProfile(*work.replay, frame);
+        work.rows = work.replay->rows;
+        work.snr = work.replay->snr;
+    } else {
+        reduceRegion(job, work, frame);
+    }
+    if (work.captureRuns) {
+        detectSymbols(work.runs, frame, pixels, work.colors);
+    }
+
+    // drop regions without any symbols before looking closer
+    work.syncs.clear();
+    work.packets.clear();
+    {
+        StageTimer search(STAGE_SEARCH);
+        float estimate;
+        work.idle = findRegions(frame, pixels, work.symbolWidth, scratch.regions, estimate) == 0;
+        if (work.idle) {
+            metricsCount(REGIONS_IDLE);
+            return;
+        }
+        float expected = work.symbolWidth > 0 ? work.symbolWidth : estimate;
+
+        // every preamble near where they should be, then anywhere active, at any
+        // width if the estimate was off, or the first run-length match if none
+        // correlates
+        if (work.predicted) {
+            correlateSync(frame, pixels, work.symbolWidth, work.windows, work.syncs);
+        }
+        if (work.syncs.empty()) {
+            correlateSync(frame, pixels, expected, scratch.regions, work.syncs);
+        }
+        if (work.syncs.empty() && work.symbolWidth <= 0) {
+            correlateSync(frame, pixels, 0, scratch.regions, work.syncs);
+        }
+        if (work.syncs.empty()) {
+            detectSymbols(scratch.runs, frame, pixels, work.colors);
+            Sync sync;
+            if (findSync(scratch.runs, work.symbolWidth, sync)) {
+                work.syncs.push_back(sync);
+            }
+        }
+    }
+    metricsCount(work.syncs.empty() ? SYNCS_MISSED : SYNCS_FOUND, max<size_t>(work.syncs.size(), 1));
+
+    work.packets.resize(work.syncs.size());
+    for (size_t k = 0; k < work.syncs.size(); k++) {
+        Demodulated &packet = work.packets[k];
+        packet.sync = work.syncs[k];
+        {
+            StageTimer demod(STAGE_DEMODULATE);
+            packet.refined = refineSync(frame, pixels, packet.sync);
+
+            // demodulate as much as a long packet, the clock is left in next
+            if (packet.refined) {
+                packet.next = packet.sync;
+                packet.symbols = demodulate(packet.soft, NSYM_LONG, frame, pixels, packet.next, packet.end);
+            }
+        }
+        if (!packet.refined) {
+            metricsCount(SYNCS_UNCLEAR);
+            continue;
+        }
+        TRACE(2, TRACE_SYNC, packet.sync.begin, (int32_t)(packet.sync.score * 1000),
+              (int32_t)(packet.sync.slot * 1000));
+        metricsCount(SYMBOLS_DEMODULATED, packet.symbols);
+
+        // decode a short packet on its own, then as a long packet
+        if (packet.symbols >= NSYM) {
+            bool decoded = decodeSymbols(packet.soft, NSYM, work.colors, packet.data, packet.erasures,
+                                         packet.corrected);
+            TRACE(2, TRACE_DECODE, decoded ? PACKET_DECODED : PACKET_FAILED, packet.erasures, packet.corrected);
+            if (decoded) {
+                packet.status = PACKET_DECODED;
+                packet.length = NMSG;
+            }
+        }
+        if (packet.length == 0 && packet.symbols == NSYM_LONG && !work.coarse) {
+            bool decoded = decodeSymbols(packet.soft, NSYM_LONG, work.colors, packet.data, packet.erasures,
+                                         packet.corrected);
+            TRACE(2, TRACE_DECODE, decoded ? PACKET_LONG : PACKET_FAILED, packet.erasures, packet.corrected);
+            if (decoded) {
+                packet.status = PACKET_LONG;
+                packet.length = NMSG_LONG;
+            }
+        }
+
+        // learn symbol colors from what the packet turned out to hold
+        if (packet.length > 0) {
+            work.colors.update(frame, packet.sync.begin, packet.end, packet.soft, packet.data,
+                               packet.length == NMSG ? NSYM : NSYM_LONG);
+        } else if (packet.end > packet.sync.begin) {
+            work.colors.update(frame, packet.sync.begin, packet.end);
+        }
+    }
+}
+
+
+// takes a receiver, the analyzed region of a frame, its timestamp and width
+// applies what the region shows to the receiver in capture order: carries long
+// packets over from the previous frame, combines failed short packets with
+// earlier attempts and appends each distinct message to the receiver's
+// packets, returns the number of messages appended
+int commitRegion(Receiver &rx, RegionWork &work, int64_t timestamp, int width)
+{
+    int count = 0;
+    rx.packets.clear();
+    rx.combiner.tick();
+
+    // the flat frame runs right to left, so columns right of the region came first
+    int pixels = work.rect.width();
+    int offset = width - work.rect.right;
+    auto frame = (int32_t (*)[3])work.flat.data();
+
+    if (work.idle) {
+        TRACE(2, TRACE_IDLE, work.receiver);
+        rx.predictor.update(vector<Sync>(), offset);
+        rx.reassembler.abort();
+        return 0;
+    }
+    rx.predictor.update(work.syncs, offset);
+
+    // carry on with a packet that ran off the end of the last frame, unless
+    // a preamble shows up before it should have ended
+    if (rx.reassembler.active()) {
+        int end;
+        bool complete = rx.reassembler.resume(frame, pixels, timestamp, offset, end);
+        if (!work.syncs.empty() && work.syncs[0].begin < end) {
+            TRACE(2, TRACE_REASSEMBLY_LOST, work.syncs[0].begin);
+            rx.reassembler.abort();
+        } else if (complete) {
+            count += decodeLong(rx, rx.reassembler.symbols());
+            rx.reassembler.abort();
+        }
+    }
+
+    for (size_t k = 0; k < work.packets.size(); k++) {
+        Demodulated &packet = work.packets[k];
+        const Sync &sync = packet.sync;
+        if (!packet.refined) {
+            continue;
+        }
+        // combine a short packet that failed with earlier attempts at it
+        bool decoded = packet.length > 0;
+        if (!decoded && packet.symbols >= NSYM) {
+            float snr = sync.score * sync.score / (1.0f - sync.score * sync.score + 1e-3f);
+            float combined[NSYM][3];
+            int entry = rx.combiner.combine(packet.soft, snr, rx.calibrator, combined);
+            if (entry >= 0 && rx.combiner.count(entry) > 1) {
+                uint8_t data[NMSG+NPAR];
+                int num_erasures, num_corrected;
+                decoded = decodeSymbols(combined, NSYM, rx.calibrator, data, num_erasures, num_corrected);
+                TRACE(2, TRACE_COMBINE, rx.combiner.count(entry), num_erasures, decoded);
+                if (decoded) {
+                    metricsCount(PACKETS_COMBINED);
+                    rx.combiner.forget(entry);
+                    packet.status = PACKET_COMBINED;
+                    packet.length = NMSG;
+                    packet.erasures = num_erasures;
+                    packet.corrected = num_corrected;
+                    memcpy(packet.data, data, sizeof(data));
+                }
+            }
+        }
+        if (decoded) {
+            rx.calibrator.update(frame, sync.begin, packet.end, packet.soft, packet.data,
+                                 packet.length == NMSG ? NSYM : NSYM_LONG);
+        } else if (packet.end > sync.begin) {
+            rx.calibrator.update(frame, sync.begin, packet.end);
+        }
+        if (decoded || packet.symbols >= NSYM) {
+            count += appendPacket(rx.packets, makeReport(packet.status, packet.data, packet.length,
+                                                         packet.erasures, packet.corrected, sync));
+        }
+
+        // stitch a long packet onto the next frame if it runs past the end of
+        // this one
+        if (!decoded && packet.symbols < NSYM_LONG && k + 1 == work.packets.size()) {
+            rx.reassembler.start(packet.soft, packet.symbols, packet.next, timestamp, offset, SLOT_NS / sync.slot);
+        }
+
+        // remember the slot width of packets that decoded
+        if (decoded) {
+            rx.symbolWidth = rx.symbolWidth > 0 ? (rx.symbolWidth * 7 + sync.slot) / 8 : sync.slot;
+        }
+    }
+
+    return count;
+}
+
+
+// takes two regions, returns the area they share
+static int overlap(const Roi &a, const Roi &b)
+{
+    int w = min(a.right, b.right) - max(a.left, b.left);
+    int h = min(a.bottom, b.bottom) - max(a.top, b.top);
+    return w > 0 && h > 0 ? w * h : 0;
+}
+
+
+// takes the regions detected in a frame, strongest first, and its width
+// a region found where a receiver was before keeps its state, others go to a
+// fresh receiver, receivers without one lose theirs
+void assignRegions(const Roi found[], int num_found, int width)
+{
+    // strongest first, to the free receiver it overlaps most
+    bool taken[MAX_RECEIVERS] = {};
+    int owner[MAX_RECEIVERS];
+    for (int i = 0; i < num_found; i++) {
+        owner[i] = -1;
+        int best = 0;
+        for (int k = 0; k < MAX_RECEIVERS; k++) {
+            int area = receivers[k].roi.frameWidth == width ? overlap(found[i], receivers[k].roi) : 0;
+            if (!taken[k] && area > best) {
+                best = area;
+                owner[i] = k;
+            }
+        }
+        if (owner[i] >= 0) {
+            taken[owner[i]] = true;
+        }
+    }
+
+    // new transmitters to the receivers left over, starting from the colors
+    // already learned since they depend mostly on the camera
+    for (int i = 0; i < num_found; i++) {
+        for (int k = 0; owner[i] < 0 && k < MAX_RECEIVERS; k++) {
+            if (!taken[k]) {
+                taken[k] = true;
+                owner[i] = k;
+                ColorCalibrator colors = receivers[0].calibrator;
+                unsigned generation = receivers[k].generation;
+                receivers[k] = Receiver();
+                receivers[k].calibrator = colors;
+                receivers[k].generation = generation + 1;
+            }
+        }
+    }
+
+    for (int k = 0; k < MAX_RECEIVERS; k++) {
+        receivers[k].roi.valid = false;
+    }
+    for (int i = 0; i < num_found; i++) {
+        if (owner[i] >= 0) {
+            receivers[owner[i]].roi = found[i];
+        }
+    }
+}
+
+
+// takes the number of a frame being submitted, the frame, a receiver, the
+// region of the frame it decodes and the row step to reduce it with
+// copies what the workers need of the receiver into the region's work
+void prepareRegion(int64_t seq, const FrameJob &job, int receiver, const Roi &roi, int rowStep, RegionWork &work)
+{
+    Receiver &rx = receivers[receiver];
+    work.receiver = receiver;
+    work.generation = rx.generation;
+    work.rect = roi;
+    work.follow = false;
+    work.fingerprint = rx.fingerprint;
+    work.lost = false;
+    work.repeated = false;
+    work.coarse = false;
+    work.rowStep = rowStep;
+    work.symbolWidth = rx.symbolWidth;
+    work.colors = rx.calibrator;
+    work.replay = nullptr;
+    work.captureRuns = capture && (capture->flags() & CAPTURE_RUNS);
+
+    // frames still in flight have not updated the predictor yet
+    int offset = job.width - work.rect.right;
+    int frames = rx.lastFrame >= 0 ? (int)(seq - rx.lastFrame) : 1;
+    work.predicted = rx.predictor.predict(rx.symbolWidth, work.rect.width(), offset, work.windows, frames);
+}
+
+
+// takes the number of a frame being submitted and the frame with its tier
+// copies the region of every transmitter in view and what the workers need of
+// its receiver into the frame's job, or the whole frame when there is time for
+// it and none is; on a schedule, or once a region is lost, the job also detects
+// them all again; returns the number of tasks to analyze
+int prepareFrame(int64_t seq, FrameJob &job)
+{
+    job.numRegions = 0;
+    job.detections = detections;
+    job.detect = false;
+    job.detectUs = 0;
+    job.numFound = 0;
+    if (job.width <= 0 || job.height <= 0) {
+        return 0;
+    }
+    if (job.tier == TIER_SKIP) {
+        metricsCount(FRAMES_SKIPPED);
+        return 0;
+    }
+    if (job.tier != TIER_FULL) {
+        metricsCount(FRAMES_DEGRADED);
+    }
+
+    // follow the regions of the last frame committed, frames still in flight
+    // may not have moved them yet
+    int active[MAX_RECEIVERS];
+    int num_active = 0;
+    for (int k = 0; k < MAX_RECEIVERS; k++) {
+        if (receivers[k].roi.valid) {
+            active[num_active++] = k;
+        }
+    }
+    bool redetect = ++regionAge >= ROI_REDETECT || regionLost || num_active == 0;
+    if (redetect && job.tier >= TIER_ROI && !detecting) {
+        regionAge = 0;
+        regionLost = false;
+        detecting = true;
+        job.detect = true;
+    }
+    if (num_active == 0 && job.tier == TIER_FULL) {
+        active[num_active++] = 0;
+    }
+
+    for (int i = 0; i < num_active; i++) {
+        Receiver &rx = receivers[active[i]];
+        Roi roi = rx.roi;
+        bool follow = roi.valid;
+        if (!follow) {
+            roi.left = roi.top = 0;
+            roi.right = job.width;
+            roi.bottom = job.height;
+        }
+
+        RegionWork &work = job.regions[job.numRegions++];
+        bool coarse = job.tier == TIER_COARSE;
+        prepareRegion(seq, job, active[i], roi, coarse ? max(rx.rowStep, COARSE_ROW_STEP) : rx.rowStep, work);
+        work.follow = follow;
+        work.coarse = coarse;
+    }
+
+    return job.numRegions + job.detect;
+}
+
+
+// takes the number of a frame being submitted and a capture frame recorded
+// hands every region recorded to the receiver that decoded it, as it was when
+// recorded, and copies what the workers need into the frame's job, returns the
+// number of regions to analyze
+int replayFrame(int64_t seq, const CaptureFrame &frame, FrameJob &job)
+{
+    job.numRegions = 0;
+    job.detections = detections;
+    job.detect = false;
+    job.detectUs = 0;
+    job.numFound = 0;
+    const CaptureRegion *region = frame.first();
+    for (int i = 0; i < frame.regions; i++, region = frame.next(region)) {
+        if (region->receiver >= MAX_RECEIVERS || job.numRegions == MAX_RECEIVERS) {
+            continue;
+        }
+
+        // a new transmitter starts from the colors already learned, as when
+        // it was recorded
+        Receiver &rx = receivers[region->receiver];
+        if (rx.generation != region->generation) {
+            ColorCalibrator colors = receivers[0].calibrator;
+            rx = Receiver();
+            rx.calibrator = colors;
+            rx.generation = region->generation;
+        }
+        rx.roi.left = region->left;
+        rx.roi.top = region->top;
+        rx.roi.right = region->right;
+        rx.roi.bottom = region->bottom;
+        rx.roi.frameWidth = frame.width;
+        rx.roi.frameHeight = frame.height;
+        rx.roi.valid = true;
+
+        RegionWork &work = job.regions[job.numRegions++];
+        prepareRegion(seq, job, region->receiver, rx.roi, region->rowStep, work);
+        work.coarse = job.tier == TIER_COARSE;
+        work.replay = region;
+    }
+
+    return job.numRegions;
+}
+
+
+// frames decoded in parallel, enough for a region on every worker besides the
+// frame being committed and the one being submitted; their jobs, one per
+// frame in flight, and the results of committed frames waiting to be collected
+// in capture order, reused so the steady state does not allocate
+int numWorkers = std::max(1, (int)std::thread::hardware_concurrency());
+int engineDepth = numWorkers + 2;
+vector<FrameJob> jobs(engineDepth);
+vector<Scratch> scratch(numWorkers);
+vector<FrameResult> results(2 * engineDepth);
+int64_t resultsQueued = 0;
+int64_t resultsCollected = 0;
+std::mutex resultLock;
+std::condition_variable resultReady;    // a result was queued
+std::condition_variable resultRoom;     // a result was collected
+
+
+// takes the number of a frame whose regions are all analyzed
+// applies them to their receivers and queues the frame's result
+void commitFrame(int64_t seq)
+{
+    FrameJob &job = jobs[seq % engineDepth];
+
+    // the caller collects before submitting more than engineDepth frames,
+    // so this only waits if it does not
+    int64_t slot;
+    {
+        std::unique_lock<std::mutex> lock(resultLock);
+        resultRoom.wait(lock, [] { return resultsQueued - resultsCollected < (int64_t)results.size(); });
+        slot = resultsQueued;
+    }
+    FrameResult &result = results[slot % results.size()];
+    result.timestamp = job.timestamp;
+    result.analyzeUs = job.detectUs;
+    result.commitUs = 0;
+    result.regions = job.numRegions;
+    result.packets.clear();
+
+    {
+        Stopwatch watch(result.commitUs);
+        std::lock_guard<std::mutex> lock(stateLock);
+        bool recording = capture && capture->beginFrame(job.timestamp, job.width, job.height, job.tier);
+        for (int i = 0; i < job.numRegions; i++) {
+            RegionWork &work = job.regions[i];
+            Receiver &rx = receivers[work.receiver];
+            result.analyzeUs += work.analyzeUs;
+            work.analyzeUs = 0;
+
+            // handed to another transmitter since the frame was submitted
+            if (rx.generation != work.generation) {
+                result.regions--;
+                continue;
+            }
+
+            // where the region went, unless a detection moved it meanwhile
+            if (work.follow && job.detections == detections) {
+                if (work.lost) {
+                    rx.roi.valid = false;
+                    regionLost = true;
+                } else {
+                    rx.roi = work.rect;
+                }
+            }
+            if (work.lost || work.repeated) {
+                if (work.repeated) {
+                    metricsCount(REGIONS_REPEATED);
+                }
+                result.regions--;
+                continue;
+            }
+            rx.fingerprint = work.fingerprint;
+
+            // recorded as reduced, before the row step adapts
+            if (recording) {
+                capture->addRegion(work.receiver, work.generation, work.rect, work.rowStep, work.rows, work.snr,
+                                   (const int32_t (*)[3])work.flat.data(),
+                                   work.captureRuns ? &work.runs : nullptr);
+            }
+
+            int num_decoded = commitRegion(rx, work, job.timestamp, job.width);
+            rx.decoded += num_decoded;
+            rx.lastFrame = seq;
+
+            // adapt the row step, going back to full reduction after a failure
+            // unless the frame was reduced coarsely regardless of it
+            if (!work.coarse) {
+                if (num_decoded == 0) {
+                    rx.rowStep = 1;
+                } else if (work.snr > SNR_HIGH && rx.rowStep < MAX_ROW_STEP && work.rows / 2 >= 2) {
+                    rx.rowStep *= 2;
+                } else if (work.snr < SNR_LOW && rx.rowStep > 1) {
+                    rx.rowStep /= 2;
+                }
+            }
+            TRACE(1, TRACE_REGION, work.receiver, (int32_t)work.snr, rx.rowStep);
+
+            // tag each report with its region
+            for (auto &report : rx.packets) {
+                report.region = work.receiver;
+                result.packets.push_back(report);
+            }
+            rx.packets.clear();
+        }
+        if (recording) {
+            capture->endFrame();
+        }
+
+        // the regions detected replace the ones followed from now on
+        if (job.detect) {
+            assignRegions(job.found, job.numFound, job.width);
+            detecting = false;
+            detections++;
+        }
+    }
+    result.latencyUs = duration_cast<microseconds>(steady_clock::now() - job.submitted).count();
+    metricsRecord(STAGE_COMMIT, result.commitUs);
+    metricsRecord(STAGE_LATENCY, result.latencyUs);
+    {
+        std::lock_guard<std::mutex> lock(stateLock);
+        scheduler.update(job.tier, result.analyzeUs, job.predictedUs, result.latencyUs);
+    }
+    TRACE(1, TRACE_COMMIT, (int32_t)seq, result.commitUs, (int32_t)result.packets.size());
+
+    // the pixels are no longer needed, replayed frames have none
+    if (job.slot >= 0) {
+        ring->release(job.slot);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(resultLock);
+        resultsQueued++;
+    }
+    resultReady.notify_all();
+}
+
+
+// takes a value and a position in a buffer
+// writes the value there and moves past it
+template <typename T>
+static void pack(uint8_t *&out, T value)
+{
+    memcpy(out, &value, sizeof(value));
+    out += sizeof(value);
+}
+
+
+size_t packResult(const FrameResult &result, uint8_t *buffer, size_t capacity)
+{
+    if (capacity < FRAME_RECORD) {
+        return 0;
+    }
+
+    // the number of packets that fit
+    size_t size = FRAME_RECORD;
+    uint16_t count = 0;
+    for (auto &report : result.packets) {
+        if (size + PACKET_RECORD + report.length > capacity) {
+            break;
+        }
+        size += PACKET_RECORD + report.length;
+        count++;
+    }
+
+    uint8_t *out = buffer;
+    pack<int64_t>(out, result.timestamp);
+    pack<uint32_t>(out, result.analyzeUs);
+    pack<uint32_t>(out, result.commitUs);
+    pack<uint32_t>(out, result.latencyUs);
+    pack<uint16_t>(out, result.regions);
+    pack<uint16_t>(out, count);
+
+    for (int i = 0; i < count; i++) {
+        const PacketReport &report = result.packets[i];
+        pack<uint8_t>(out, report.region);
+        pack<uint8_t>(out, report.status);
+        pack<uint8_t>(out, report.length);
+        pack<uint8_t>(out, report.erasures);
+        pack<uint8_t>(out, report.corrected);
+        pack<uint8_t>(out, 0);
+        pack<uint16_t>(out, 0);
+        pack<int32_t>(out, report.sync);
+        pack<float>(out, report.slot);
+        memcpy(out, report.data, report.length);
+        out += report.length;
+    }
+
+    return out - buffer;
+}
+
+
+// returns the engine, starting its workers on the first frame submitted
+// rather than while the library loads, and stopping them before the jobs
+// they work on are destroyed at exit
+static FrameEngine &frameEngine()
+{
+    static FrameEngine engine(numWorkers, engineDepth,
+                              [](int worker, int64_t seq, int task) {
+                                  FrameJob &job = jobs[seq % engineDepth];
+                                  if (task == job.numRegions) {
+                                      detectFrame(job);
+                                      return;
+                                  }
+                                  RegionWork &work = job.regions[task];
+                                  if (locateRegion(job, work)) {
+                                      analyzeRegion(scratch[worker], job, work);
+                                      TRACE(1, TRACE_ANALYZE, work.receiver, work.analyzeUs,
+                                            (int32_t)work.syncs.size());
+                                  }
+                              },
+                              commitFrame);
+    return engine;
+}
+
+
+
+void createRing(int slots, size_t capacity, bool dropOldest)
+{
+    delete ring;
+    ring = new FrameRing(slots, capacity, dropOldest);
+    dropsCounted = 0;
+}
+
+
+void countDrops()
+{
+    uint64_t drops = ring->dropped();
+    uint64_t counted = dropsCounted.exchange(drops);
+    if (drops > counted) {
+        metricsCount(FRAMES_DROPPED, drops - counted);
+    }
+}
+
+
+int64_t submitFrame(int slot)
+{
+    metricsCount(FRAMES_SUBMITTED);
+    FrameEngine &engine = frameEngine();
+    return engine.submit([&](int64_t seq) {
+        FrameJob &job = jobs[seq % engineDepth];
+        job.slot = slot;
+        job.rgba = ring->data(slot);
+        job.width = ring->width(slot);
+        job.height = ring->height(slot);
+        job.timestamp = ring->timestamp(slot);
+        job.submitted = steady_clock::now();
+
+        int inFlight = engine.inFlight();
+        int waiting = ring->waiting();
+
+        // as much of the frame as its latency budget allows
+        std::lock_guard<std::mutex> lock(stateLock);
+        job.tier = scheduler.choose(inFlight, waiting, engine.workers(), job.predictedUs);
+        int tasks = prepareFrame(seq, job);
+        TRACE(1, TRACE_SUBMIT, (int32_t)seq, job.numRegions, job.tier);
+        return tasks;
+    });
+}
+
+
+int64_t submitCapture(const CaptureFrame &frame)
+{
+    metricsCount(FRAMES_SUBMITTED);
+    return frameEngine().submit([&](int64_t seq) {
+        FrameJob &job = jobs[seq % engineDepth];
+        job.slot = -1;
+        job.rgba = nullptr;
+        job.width = frame.width;
+        job.height = frame.height;
+        job.timestamp = frame.timestamp;
+        job.submitted = steady_clock::now();
+
+        // decoded as far as it was when recorded
+        std::lock_guard<std::mutex> lock(stateLock);
+        job.tier = frame.tier < NUM_TIERS ? (Tier)frame.tier : TIER_FULL;
+        job.predictedUs = 0;
+        int regions = replayFrame(seq, frame, job);
+        TRACE(1, TRACE_SUBMIT, (int32_t)seq, regions, job.tier);
+        return regions;
+    });
+}
+
+
+bool collectFrame(const std::function<void(const FrameResult &)> &collect, bool wait)
+{
+    int64_t slot;
+    {
+        std::unique_lock<std::mutex> lock(resultLock);
+        if (wait) {
+            resultReady.wait(lock, [] { return resultsQueued > resultsCollected; });
+        }
+        if (resultsQueued == resultsCollected) {
+            return false;
+        }
+        slot = resultsCollected;
+    }
+
+    // the slot is not reused until it is counted as collected
+    collect(results[slot % results.size()]);
+
+    {
+        std::lock_guard<std::mutex> lock(resultLock);
+        resultsCollected++;
+    }
+    resultRoom.notify_all();
+    return true;
+}
+
+
+void setLatencyBudget(uint32_t us)
+{
+    std::lock_guard<std::mutex> lock(stateLock);
+    scheduler.setBudget(us > 0 ? us : SCHEDULE_BUDGET_US);
+}
+
+
+void resetReceivers()
+{
+    std::lock_guard<std::mutex> lock(stateLock);
+    for (auto &rx : receivers) {
+        unsigned generation = rx.generation;
+        rx = Receiver();
+        rx.generation = generation + 1;
+    }
+    regionAge = 0;
+    regionLost = false;
+    detecting = false;
+}
+
+
+bool startCapture(const char *path, bool runs)
+{
+    std::unique_ptr<CaptureWriter> writer(new CaptureWriter());
+    if (!writer->open(path, runs ? CAPTURE_RUNS : 0)) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(stateLock);
+        capture.swap(writer);
+    }
+
+    // the previous capture is finished outside the lock
+    writer.reset();
+    return true;
+}
+
+
+void stopCapture()
+{
+    std::unique_ptr<CaptureWriter> writer;
+    {
+        std::lock_guard<std::mutex> lock(stateLock);
+        writer.swap(capture);
+    }
+    writer.reset();
+}
+
+
+size_t saveCalibration(uint8_t *blob, size_t len, int width, int height)
+{
+    std::lock_guard<std::mutex> lock(stateLock);
+    Receiver *rx = &receivers[0];
+    for (auto &candidate : receivers) {
+        if (candidate.decoded > rx->decoded) {
+            rx = &candidate;
+        }
+    }
+    return saveCache(blob, len, width, height, rx->roi, rx->calibrator, rx->symbolWidth);
+}
+
+
+bool loadCalibration(const uint8_t *blob, size_t len, int width, int height)
+{
+    // the most decoded transmitter of the last session
+    std::lock_guard<std::mutex> lock(stateLock);
+    Receiver &rx = receivers[0];
+    return loadCache(blob, len, width, height, rx.roi, rx.calibrator, rx.symbolWidth);
+}
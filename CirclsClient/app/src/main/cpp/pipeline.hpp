@@ -0,0 +1,127 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "calibrate.hpp"
+#include "capture.hpp"
+#include "combine.hpp"
+#include "packet.hpp"
+#include "predict.hpp"
+#include "reassemble.hpp"
+#include "ring.hpp"
+#include "roi.hpp"
+
+// one LED transmitter in view and everything learned about it
+struct Receiver {
+    Roi roi;                            // LED region tracked across frames
+    int rowStep = 1;                    // rows skipped by the reduction
+    ColorCalibrator calibrator;         // symbol colors learned this session
+    Combiner combiner{NSYM};            // failed packets kept for combining with repeats
+    SyncPredictor predictor;            // where the next preambles should appear
+    Reassembler reassembler{NSYM_LONG}; // long packet running past the frame
+    float symbolWidth = 0;              // pixels per symbol slot, 0 until learned
+    std::vector<PacketReport> packets;  // decode attempts of the current frame
+    unsigned generation = 0;            // counts the transmitters it was handed
+    uint64_t fingerprint = 0;           // column profile of the last region submitted
+    int64_t lastFrame = -1;             // last frame committed to it
+    int decoded = 0;                    // packets decoded from its transmitter
+};
+
+// transmitters decoded side by side, the index is the region reported with
+// their packets; the first also decodes the whole frame when none are found
+#define MAX_RECEIVERS 4
+extern Receiver receivers[MAX_RECEIVERS];
+extern std::mutex stateLock;            // guards the receivers
+
+// camera frames waiting to be decoded, see createRing
+extern FrameRing *ring;
+
+// frames the engine decodes at once, from the number of cores; callers collect
+// before submitting more
+extern int engineDepth;
+
+// one committed frame as reported to the app
+struct FrameResult {
+    int64_t timestamp;
+    uint32_t analyzeUs;         // time the workers spent on its regions
+    uint32_t commitUs;          // time spent committing it
+    uint32_t latencyUs;         // from its submission to the end of its commit
+    int regions;
+    std::vector<PacketReport> packets;
+};
+
+// sizes of the records packed for the app, little endian like every target
+#define FRAME_RECORD  24    // i64 timestamp, u32 analyze, commit and latency
+                            // in us, u16 regions, u16 packets
+#define PACKET_RECORD 16    // u8 region, status, length, erasures, corrected,
+                            // 3 reserved, i32 sync, f32 slot, then the message
+
+// takes the number of slots, the bytes each holds and whether the oldest
+// waiting frame is dropped when the ring is full
+// replaces the ring; no frame of the old one may still be submitted or
+// uncollected
+void createRing(int slots, size_t capacity, bool dropOldest);
+
+// adds the frames the ring dropped since the last call to the metrics
+void countDrops();
+
+// takes a ring slot taken by the consumer
+// queues its frame for decoding, the slot is released once it is committed;
+// returns the frame number
+int64_t submitFrame(int slot);
+
+// takes a frame of a mapped capture, which stays mapped until it is collected
+// queues its recorded regions for decoding in place of a camera frame;
+// returns the frame number
+int64_t submitCapture(const CaptureFrame &frame);
+
+// takes a function and whether to wait for a frame to be committed
+// calls it with the oldest committed frame not collected yet, in capture
+// order, returns false if there is none
+bool collectFrame(const std::function<void(const FrameResult &)> &collect, bool wait);
+
+// takes a committed frame and a buffer
+// packs the frame record followed by a record per packet, as many as fit,
+// returns the bytes written, 0 if not even the frame record fits
+size_t packResult(const FrameResult &result, uint8_t *buffer, size_t capacity);
+
+// takes the latency each frame is kept within in us, 0 for the default
+void setLatencyBudget(uint32_t us);
+
+// takes a path and whether to keep the symbol runs of every region
+// records every frame committed from now on there, written in the
+// background, replacing any capture being recorded; returns false if it
+// cannot be created
+bool startCapture(const char *path, bool runs);
+
+// finishes the capture being recorded, if any
+void stopCapture();
+
+// forgets every transmitter and what was learned about it, as if the
+// receiver just started; no frame may be in flight
+void resetReceivers();
+
+// takes a buffer of at least sizeof(CacheBlob) bytes and the camera resolution
+// saves what the receiver that decoded the most packets learned, returns the
+// bytes written
+size_t saveCalibration(uint8_t *blob, size_t len, int width, int height);
+
+// takes a blob from saveCalibration and the camera resolution
+// warm starts the first receiver with it, returns false if the blob is stale
+bool loadCalibration(const uint8_t *blob, size_t len, int width, int height);
+
+// takes how a codeword decoded, the codeword and the message bytes in it,
+// the erasure and correction counts and the preamble it followed
+// returns the report of it for the app
+PacketReport makeReport(int status, const uint8_t *data, int length, int erasures, int corrected,
+                        const Sync &sync);
+
+// takes a decode attempt
+// appends it to reports unless it decoded a message already there, returns
+// true if it added a message
+bool appendPacket(std::vector<PacketReport> &reports, PacketReport report);
+
+#endif // PIPELINE_HPP
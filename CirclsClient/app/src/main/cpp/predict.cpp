@@ -0,0 +1,96 @@
+#include "predict.hpp"
+#include <math.h>
+
+#define MIN_HITS        3       // matching frames before the prediction is used
+#define SPACING_TOLERANCE 0.05f // relative error of a spacing that still matches
+#define DRIFT_TOLERANCE 4.0f    // slots a preamble may land from its prediction
+#define WINDOW_SLOTS    3.0f    // slots searched on either side of a prediction
+#define GAIN            0.25f   // share of an error blended into the estimates
+
+// takes a value and a period, returns the value wrapped into [-period/2, period/2)
+static float wrap(float x, float period)
+{
+    return x - period * floorf(x / period + 0.5f);
+}
+
+void SyncPredictor::reset()
+{
+    spacing = 0;
+    drift = 0;
+    phase = -1;
+    hits = 0;
+}
+
+bool SyncPredictor::predict(float slot, int pixels, int offset, std::vector<Window> &windows, int frames) const
+{
+    windows.clear();
+    if (hits < MIN_HITS || spacing <= 0 || slot <= 0 || frames < 1) {
+        return false;
+    }
+
+    // every repeat of the predicted preamble within the frame
+    int radius = (int)ceilf(WINDOW_SLOTS * slot);
+    float first = fmodf(phase + fmodf(frames * drift, spacing) - offset, spacing);
+    if (first < 0) {
+        first += spacing;
+    }
+    for (float p = first; p - radius < pixels; p += spacing) {
+        Window win;
+        win.first = (int)floorf(p) - radius;
+        win.last = (int)ceilf(p) + radius;
+        if (!windows.empty() && win.first <= windows.back().last) {
+            windows.back().last = win.last;
+        } else {
+            windows.push_back(win);
+        }
+    }
+
+    return true;
+}
+
+void SyncPredictor::update(const std::vector<Sync> &syncs, int offset)
+{
+    // nothing seen, assume the preambles moved on as predicted
+    if (syncs.empty()) {
+        if (phase >= 0 && spacing > 0) {
+            phase = fmodf(phase + drift, spacing);
+        }
+        hits = 0;
+        return;
+    }
+
+    // learn the spacing from preambles repeated within the frame
+    for (size_t i = 1; i < syncs.size(); i++) {
+        float gap = syncs[i].begin - syncs[i - 1].begin;
+        if (spacing <= 0) {
+            spacing = gap;
+            continue;
+        }
+        float n = roundf(gap / spacing);
+        if (n >= 1 && fabsf(gap - n * spacing) <= SPACING_TOLERANCE * spacing) {
+            spacing += GAIN * (gap / n - spacing);
+        } else if (n < 1) {
+            spacing = gap;
+            hits = 0;
+        }
+    }
+    if (spacing <= 0) {
+        phase = -1;
+        return;
+    }
+
+    // then the drift of the first preamble from the last frame
+    float begin = fmodf(syncs[0].begin + offset, spacing);
+    if (phase >= 0) {
+        float observed = wrap(begin - phase, spacing);
+        float error = wrap(observed - drift, spacing);
+        if (hits > 0 && fabsf(error) <= DRIFT_TOLERANCE * syncs[0].slot) {
+            drift = wrap(drift + GAIN * error, spacing);
+            hits++;
+        } else {
+            drift = observed;
+            hits = 1;
+        }
+    }
+    phase = begin;
+}
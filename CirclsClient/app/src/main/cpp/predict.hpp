@@ -0,0 +1,33 @@
+#ifndef PREDICT_HPP
+#define PREDICT_HPP
+#include <vector>
+#include "demod.hpp"
+
+// learns where preambles fall from frame to frame; the transmitter repeats
+// packets at a fixed period and the camera reads frames at a fixed period, so
+// preambles repeat at a fixed spacing within a frame and shift by a fixed
+// drift between frames
+class SyncPredictor {
+public:
+    // forget the learned spacing and drift
+    void reset();
+
+    // takes the slot width, the size of a later flat frame, the number of
+    // pixels read out ahead of it and how many frames after the last update
+    // it comes; fills windows around the predicted preamble offsets, returns
+    // false if the prediction cannot be trusted yet
+    bool predict(float slot, int pixels, int offset, std::vector<Window> &windows, int frames = 1) const;
+
+    // takes the preambles found in a frame, in order, and the number of
+    // pixels read out ahead of it
+    void update(const std::vector<Sync> &syncs, int offset);
+
+private:
+    float spacing = 0;      // pixels between repeated preambles, 0 until learned
+    float drift = 0;        // shift of the preambles between frames, modulo spacing
+    float phase = -1;       // readout position of the first preamble in the last
+                            // frame, modulo spacing
+    int hits = 0;           // consecutive frames that matched the drift
+};
+
+#endif // PREDICT_HPP
@@ -0,0 +1,59 @@
+#include "reassemble.hpp"
+
+#define MAX_LOST 0.125f // share of a packet that may fall between frames, erasing
+                        // at most half the parity of a long packet
+
+Reassembler::Reassembler(int symbols) : total(symbols), soft(symbols * 3)
+{
+}
+
+void Reassembler::start(const float symbols[][3], int n, const Sync &next, int64_t timestamp, int offset,
+                        double pixelTime)
+{
+    count = n < total ? n : total;
+    for (int i = 0; i < count * 3; i++) {
+        soft[i] = symbols[i / 3][i % 3];
+    }
+
+    this->pixelTime = pixelTime;
+    nextTime = timestamp + (offset + next.start) * pixelTime;
+    periodTime = 2 * next.slot * pixelTime;
+    offL = next.offL;
+}
+
+bool Reassembler::resume(const int32_t frame[][3], int pixels, int64_t timestamp, int offset, int &end)
+{
+    end = 0;
+    if (!active()) {
+        return false;
+    }
+
+    // symbols that fell between the frames read as off, so they are erased
+    double first = timestamp + offset * pixelTime;
+    float period = periodTime / pixelTime;
+    float phase = (nextTime - first) / pixelTime;
+    int lost = 0;
+    while (phase < 0 && count < total) {
+        float *s = &soft[count * 3];
+        s[0] = offL;
+        s[1] = s[2] = 0;
+        count++;
+        lost++;
+        phase += period;
+    }
+    if (lost > total * MAX_LOST || phase >= pixels) {
+        abort();
+        return false;
+    }
+
+    // carry on with the clock from the previous frame
+    Sync clock;
+    clock.start = phase;
+    clock.slot = period / 2;
+    clock.offL = offL;
+    count += demodulate((float (*)[3])&soft[count * 3], total - count, frame, pixels, clock, end);
+
+    nextTime = first + clock.start * pixelTime;
+    periodTime = 2 * clock.slot * pixelTime;
+    return count == total;
+}
@@ -0,0 +1,45 @@
+#ifndef REASSEMBLE_HPP
+#define REASSEMBLE_HPP
+#include <stdint.h>
+#include <vector>
+#include "demod.hpp"
+
+// stitches the symbols of a packet that runs past the end of a frame onto
+// the symbols at the start of the following frames, carrying the symbol
+// clock across the gap between frames by their timestamps
+class Reassembler {
+public:
+    // takes the number of symbols in a packet
+    explicit Reassembler(int symbols);
+
+    bool active() const { return count > 0; }
+
+    // takes the soft symbols at the end of a frame and the clock demodulate()
+    // left after them, the frame timestamp, the number of pixels read out
+    // ahead of the flat frame and the time to read out one pixel
+    void start(const float soft[][3], int n, const Sync &next, int64_t timestamp, int offset,
+               double pixelTime);
+
+    // takes the next flat frame, its timestamp and the pixels read out ahead of it
+    // demodulates the rest of the packet from it, erasing symbols lost between
+    // frames, returns true once all symbols are in; the first pixel after the
+    // symbols taken from this frame is stored in end
+    bool resume(const int32_t frame[][3], int pixels, int64_t timestamp, int offset, int &end);
+
+    // gives up on the packet
+    void abort() { count = 0; }
+
+    // returns the soft symbols collected so far
+    const float (*symbols() const)[3] { return (const float (*)[3])soft.data(); }
+
+private:
+    int total;                  // symbols in a packet
+    int count = 0;              // symbols collected
+    std::vector<float> soft;    // Lab of each symbol
+    double nextTime = 0;        // time of the next expected symbol
+    double periodTime = 0;      // time between symbols
+    double pixelTime = 0;       // time to read out one pixel
+    float offL = 0;             // luminance of an off slot
+};
+
+#endif // REASSEMBLE_HPP
@@ -0,0 +1,114 @@
+#include "ring.hpp"
+
+FrameRing::FrameRing(int slots, size_t capacity, bool dropOldest)
+    : count(slots), size(capacity), dropOldest(dropOldest),
+      memory(new uint8_t[slots * capacity]), frames(new Frame[slots])
+{
+}
+
+int FrameRing::oldest() const
+{
+    int slot = -1;
+    uint64_t first = 0;
+    for (int i = 0; i < count; i++) {
+        uint64_t seq = frames[i].seq.load(std::memory_order_relaxed);
+        if (frames[i].state.load() == READY && (slot < 0 || seq < first)) {
+            slot = i;
+            first = seq;
+        }
+    }
+    return slot;
+}
+
+int FrameRing::acquire()
+{
+    // a free slot
+    for (int i = 0; i < count; i++) {
+        int expected = FREE;
+        if (frames[i].state.compare_exchange_strong(expected, WRITING)) {
+            return i;
+        }
+    }
+
+    // otherwise the oldest waiting frame, unless the consumer takes it first
+    drops++;
+    for (int slot = oldest(); dropOldest && slot >= 0; slot = oldest()) {
+        int expected = READY;
+        if (frames[slot].state.compare_exchange_strong(expected, WRITING)) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+void FrameRing::publish(int slot, int width, int height, int64_t timestamp)
+{
+    Frame &frame = frames[slot];
+    frame.seq.store(++published, std::memory_order_relaxed);
+    frame.width = width;
+    frame.height = height;
+    frame.timestamp = timestamp;
+    frame.state.store(READY);
+
+    if (sleepers.load() > 0) {
+        std::lock_guard<std::mutex> lk(lock);
+        ready.notify_one();
+    }
+}
+
+int FrameRing::take()
+{
+    while (!closed.load()) {
+        int slot = oldest();
+        if (slot >= 0) {
+            int expected = READY;
+            if (frames[slot].state.compare_exchange_strong(expected, READING)) {
+                return slot;
+            }
+            continue;
+        }
+
+        // sleep until the producer publishes, counted first so it notifies
+        std::unique_lock<std::mutex> lk(lock);
+        sleepers++;
+        ready.wait(lk, [this] { return closed.load() || oldest() >= 0; });
+        sleepers--;
+    }
+    return -1;
+}
+
+bool FrameRing::pending() const
+{
+    return oldest() >= 0;
+}
+
+int FrameRing::waiting() const
+{
+    int ready = 0;
+    for (int i = 0; i < count; i++) {
+        ready += frames[i].state.load() == READY;
+    }
+    return ready;
+}
+
+void FrameRing::release(int slot)
+{
+    frames[slot].state.store(FREE);
+}
+
+void FrameRing::drop()
+{
+    for (int i = 0; i < count; i++) {
+        int expected = READY;
+        if (frames[i].state.compare_exchange_strong(expected, FREE)) {
+            drops++;
+        }
+    }
+}
+
+void FrameRing::close()
+{
+    closed.store(true);
+    std::lock_guard<std::mutex> lk(lock);
+    ready.notify_all();
+}
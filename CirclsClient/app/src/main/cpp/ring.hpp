@@ -0,0 +1,87 @@
+#ifndef RING_HPP
+#define RING_HPP
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+// preallocated frame buffers handed from the camera thread to the decoder;
+// handing over is lock-free while frames are waiting, but take() blocks on
+// an empty ring and the producer locks to wake it; when every buffer is busy
+// the oldest frame still waiting is dropped for the new one, or the new one
+// is dropped if dropOldest is off
+// one thread fills buffers, one takes them, any thread may release them
+class FrameRing {
+public:
+    // takes the number of buffers and the bytes in each
+    FrameRing(int slots, size_t capacity, bool dropOldest);
+
+    int slots() const { return count; }
+    size_t capacity() const { return size; }
+    uint8_t *data(int slot) { return memory.get() + slot * size; }
+
+    // the frame held by a published slot
+    int width(int slot) const { return frames[slot].width; }
+    int height(int slot) const { return frames[slot].height; }
+    int64_t timestamp(int slot) const { return frames[slot].timestamp; }
+
+    // producer: returns a slot to fill, or -1 if the new frame is dropped
+    int acquire();
+
+    // producer: hands a filled slot to the consumer
+    void publish(int slot, int width, int height, int64_t timestamp);
+
+    // consumer: waits for the oldest published frame and returns its slot,
+    // or -1 once the ring is closed
+    int take();
+
+    // returns true if a published frame is waiting to be taken
+    bool pending() const;
+
+    // returns the number of published frames waiting to be taken
+    int waiting() const;
+
+    // returns a taken slot to the producer
+    void release(int slot);
+
+    // drops every frame waiting to be taken
+    void drop();
+
+    // wakes the consumer for good
+    void close();
+
+    // frames dropped so far
+    uint64_t dropped() const { return drops; }
+
+private:
+    enum State { FREE, WRITING, READY, READING };
+
+    struct Frame {
+        std::atomic<int> state{FREE};
+        std::atomic<uint64_t> seq{0};   // publication order, read while it is rewritten
+        int width = 0;
+        int height = 0;
+        int64_t timestamp = 0;
+    };
+
+    // returns the slot of the oldest published frame, -1 if none
+    int oldest() const;
+
+    int count;
+    size_t size;
+    bool dropOldest;
+    std::unique_ptr<uint8_t[]> memory;
+    std::unique_ptr<Frame[]> frames;
+    uint64_t published = 0;             // written by the producer only
+    std::atomic<uint64_t> drops{0};
+
+    // the consumer sleeps only when nothing is published
+    std::atomic<int> sleepers{0};
+    std::atomic<bool> closed{false};
+    std::mutex lock;
+    std::condition_variable ready;
+};
+
+#endif // RING_HPP
@@ -0,0 +1,251 @@
+#include "roi.hpp"
+#include "arena.hpp"
+#include "hash.hpp"
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+#define ROI_ROW_STEP    4   // rows skipped between energy samples
+#define ROI_COL_STEP    2   // columns skipped between energy samples
+#define ROI_LAG         2   // column distance used to measure stripe edges
+#define ROI_MIN_ENERGY  6   // weakest mean luminance step treated as stripes
+#define ROI_ROW_GAP     2   // weak sampled rows tolerated inside a band
+#define ROI_COL_WINDOW  64  // columns averaged to bridge uniform symbol runs
+#define ROI_MIN_WIDTH   64  // narrowest accepted column span
+#define ROI_TRACK_ROWS  8   // rows sampled when re-validating a region
+#define ROI_PRINT_SHIFT 2   // low color bits left out of fingerprints
+
+// cheap luminance of an RGBA pixel
+static inline int32_t luma(const uint8_t *px)
+{
+    return (px[0] + 2 * px[1] + px[2]) >> 2;
+}
+
+// takes one frame row and a column span
+// returns the mean luminance step between nearby columns
+static int32_t rowEnergy(const uint8_t *rgba, int width, int row, int left, int right)
+{
+    const uint8_t *line = rgba + (size_t)row * width * 4;
+    int32_t sum = 0;
+    int count = 0;
+
+    for (int j = left + ROI_LAG; j < right; j += ROI_COL_STEP) {
+        sum += abs(luma(line + j * 4) - luma(line + (j - ROI_LAG) * 4));
+        count++;
+    }
+
+    return count ? sum / count : 0;
+}
+
+// takes a band of rows, returns their mean energy inside the column span
+static int32_t bandEnergy(const uint8_t *rgba, int width, const Roi &roi, int samples)
+{
+    int step = roi.height() / samples;
+    if (step < 1) {
+        step = 1;
+    }
+
+    int32_t sum = 0;
+    int count = 0;
+    for (int i = roi.top + step / 2; i < roi.bottom; i += step) {
+        sum += rowEnergy(rgba, width, i, roi.left, roi.right);
+        count++;
+    }
+
+    return count ? sum / count : 0;
+}
+
+// takes an RGBA frame, fills bands with the sampled row ranges [first, last]
+// whose stripe energy stands out, allowing short weak gaps
+static void findBands(const uint8_t *rgba, int width, int height, std::vector<std::pair<int, int>> &bands)
+{
+    bands.clear();
+
+    // stripe energy of every sampled row
+    int rows = height / ROI_ROW_STEP;
+    if (rows == 0 || width <= ROI_MIN_WIDTH) {
+        return;
+    }
+    ArenaScope scope;
+    int32_t *energy = scope.arena.alloc<int32_t>(rows);
+    int32_t peak = 0;
+    for (int i = 0; i < rows; i++) {
+        energy[i] = rowEnergy(rgba, width, i * ROI_ROW_STEP, 0, width);
+        if (energy[i] > peak) {
+            peak = energy[i];
+        }
+    }
+    if (peak < ROI_MIN_ENERGY) {
+        return;
+    }
+
+    int32_t threshold = peak / 4 > ROI_MIN_ENERGY ? peak / 4 : ROI_MIN_ENERGY;
+    int runFirst = -1, runLast = -1, gap = 0;
+    for (int i = 0; i < rows; i++) {
+        if (energy[i] >= threshold) {
+            if (runFirst < 0) {
+                runFirst = i;
+            }
+            runLast = i;
+            gap = 0;
+        } else if (runFirst >= 0 && ++gap > ROI_ROW_GAP) {
+            bands.push_back(std::make_pair(runFirst, runLast));
+            runFirst = -1;
+            gap = 0;
+        }
+    }
+    if (runFirst >= 0) {
+        bands.push_back(std::make_pair(runFirst, runLast));
+    }
+}
+
+// takes an RGBA frame and a band of rows, fills spans with the column ranges
+// [left, right) whose activity stands out
+static void findSpans(const uint8_t *rgba, int width, int top, int bottom,
+                      std::vector<std::pair<int, int>> &spans)
+{
+    spans.clear();
+
+    // average luminance of each column inside the band
+    ArenaScope scope;
+    int32_t *column = scope.arena.alloc<int32_t>(width, true);
+    int samples = 0;
+    for (int i = top; i < bottom; i += ROI_ROW_STEP) {
+        const uint8_t *line = rgba + (size_t)i * width * 4;
+        for (int j = 0; j < width; j++) {
+            column[j] += luma(line + j * 4);
+        }
+        samples++;
+    }
+    if (samples == 0) {
+        return;
+    }
+
+    // column activity, summed over a window wide enough to span a symbol run
+    int32_t *activity = scope.arena.alloc<int32_t>(width + 1);
+    activity[0] = 0;
+    for (int j = 0; j < width; j++) {
+        int32_t step = j >= ROI_LAG ? abs(column[j] - column[j - ROI_LAG]) / samples : 0;
+        activity[j + 1] = activity[j] + step;
+    }
+    int half = ROI_COL_WINDOW / 2;
+    int32_t colPeak = 0;
+    for (int j = half; j + half <= width; j++) {
+        int32_t sum = activity[j + half] - activity[j - half];
+        if (sum > colPeak) {
+            colPeak = sum;
+        }
+    }
+    int32_t colThreshold = colPeak / 4;
+    for (int j = half; j + half <= width; j++) {
+        if (activity[j + half] - activity[j - half] >= colThreshold) {
+            if (!spans.empty() && j - half <= spans.back().second) {
+                spans.back().second = j + half;
+            } else {
+                spans.push_back(std::make_pair(j - half, j + half));
+            }
+        }
+    }
+}
+
+int detectRois(const uint8_t *rgba, int width, int height, Roi rois[], int maxRois)
+{
+    std::vector<Roi> found;
+
+    // every band of strong rows, split into its separate active column spans
+    std::vector<std::pair<int, int>> bands, spans;
+    findBands(rgba, width, height, bands);
+    for (auto &band : bands) {
+        Roi roi;
+        roi.frameWidth = width;
+        roi.frameHeight = height;
+        roi.top = band.first * ROI_ROW_STEP;
+        roi.bottom = (band.second + 1) * ROI_ROW_STEP;
+        if (roi.bottom > height) {
+            roi.bottom = height;
+        }
+
+        findSpans(rgba, width, roi.top, roi.bottom, spans);
+        for (auto &span : spans) {
+            roi.left = span.first;
+            roi.right = span.second;
+            if (roi.width() < ROI_MIN_WIDTH) {
+                continue;
+            }
+            roi.energy = bandEnergy(rgba, width, roi, ROI_TRACK_ROWS);
+            roi.valid = roi.energy >= ROI_MIN_ENERGY;
+            if (roi.valid) {
+                found.push_back(roi);
+            }
+        }
+    }
+
+    // strongest first
+    std::sort(found.begin(), found.end(), [](const Roi &a, const Roi &b) {
+        return a.energy * a.height() > b.energy * b.height();
+    });
+    int count = std::min((int)found.size(), maxRois);
+    std::copy(found.begin(), found.begin() + count, rois);
+    return count;
+}
+
+bool followRoi(const uint8_t *rgba, int width, int height, Roi &roi)
+{
+    if (!roi.valid || roi.frameWidth != width || roi.frameHeight != height) {
+        return false;
+    }
+
+    // stripes still inside the band?
+    int32_t energy = bandEnergy(rgba, width, roi, ROI_TRACK_ROWS);
+    if (energy < roi.energy / 2 || energy < ROI_MIN_ENERGY) {
+        return false;
+    }
+    roi.energy = roi.energy ? (roi.energy * 3 + energy) / 4 : energy;
+
+    // grow the band if the LED moved or got closer
+    int32_t threshold = roi.energy / 2;
+    while (roi.top >= ROI_ROW_STEP
+           && rowEnergy(rgba, width, roi.top - ROI_ROW_STEP, roi.left, roi.right) >= threshold)
+    {
+        roi.top -= ROI_ROW_STEP;
+    }
+    while (roi.bottom + ROI_ROW_STEP <= height
+           && rowEnergy(rgba, width, roi.bottom, roi.left, roi.right) >= threshold)
+    {
+        roi.bottom += ROI_ROW_STEP;
+    }
+
+    return true;
+}
+
+uint64_t fingerprintRoi(const uint8_t *rgba, int width, const Roi &roi)
+{
+    int step = roi.height() / ROI_TRACK_ROWS;
+    if (step < 1) {
+        step = 1;
+    }
+
+    // mean color of every column over the sampled rows; luminance alone
+    // cannot tell symbols of equal brightness apart, red from blue
+    ArenaScope scope;
+    int n = roi.width() * 3;
+    int32_t *column = scope.arena.alloc<int32_t>(n, true);
+    int samples = 0;
+    for (int i = roi.top + step / 2; i < roi.bottom; i += step) {
+        const uint8_t *line = rgba + ((size_t)i * width + roi.left) * 4;
+        for (int j = 0; j < roi.width(); j++) {
+            column[j * 3] += line[j * 4];
+            column[j * 3 + 1] += line[j * 4 + 1];
+            column[j * 3 + 2] += line[j * 4 + 2];
+        }
+        samples++;
+    }
+
+    int bounds[4] = {roi.left, roi.top, roi.right, roi.bottom};
+    uint64_t hash = fingerprint(bounds, sizeof(bounds));
+    uint8_t *profile = scope.arena.alloc<uint8_t>(n, true);
+    for (int j = 0; j < n && samples > 0; j++) {
+        profile[j] = (column[j] / samples) >> ROI_PRINT_SHIFT;
+    }
+    return fingerprint(profile, n, hash);
+}
@@ -0,0 +1,44 @@
+#ifndef ROI_HPP
+#define ROI_HPP
+#include <stdint.h>
+
+#define ROI_REDETECT    30  // frames between full detections
+
+// region of the frame covered by the LED's rolling-shutter stripes
+// right and bottom are exclusive
+struct Roi {
+    int left = 0;
+    int top = 0;
+    int right = 0;
+    int bottom = 0;
+
+    // resolution the region was detected at
+    int frameWidth = 0;
+    int frameHeight = 0;
+
+    // average stripe energy of the rows inside the region, 0 if not measured
+    int32_t energy = 0;
+
+    bool valid = false;
+
+    int width() const { return right - left; }
+    int height() const { return bottom - top; }
+};
+
+// takes an RGBA frame, fills up to maxRois regions holding separate LED
+// stripes, strongest first, returns the number found
+int detectRois(const uint8_t *rgba, int width, int height, Roi rois[], int maxRois);
+
+// takes an RGBA frame and the region from the previous frame
+// re-validates the region cheaply and grows it if the LED moved, returns
+// false once it no longer holds the stripes
+bool followRoi(const uint8_t *rgba, int width, int height, Roi &roi);
+
+// takes an RGBA frame and a region of it
+// returns a fingerprint of the region's mean color per column over
+// ROI_TRACK_ROWS rows, with the low bits dropped; a heuristic for a frame
+// showing what the last one did, since rows left out or a change smaller
+// than the bits dropped can reduce differently and still fingerprint the same
+uint64_t fingerprintRoi(const uint8_t *rgba, int width, const Roi &roi);
+
+#endif // ROI_HPP
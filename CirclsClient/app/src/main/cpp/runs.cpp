@@ -0,0 +1,84 @@
+#include "runs.hpp"
+#include "calibrate.hpp"
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+void Runs::clear()
+{
+    symbol.clear();
+    width.clear();
+    start.clear();
+}
+
+void Runs::push(char s, uint32_t first, uint32_t end)
+{
+    for (; first < end; first += MAX_RUN) {
+        symbol.push_back(s);
+        width.push_back(end - first < MAX_RUN ? end - first : MAX_RUN);
+        start.push_back(first);
+    }
+}
+
+// takes 16 classes and the ones a pixel earlier, returns a mask with a bit
+// set for every pixel whose class differs from the previous one; pixel j is
+// at bit j << TRANSITION_SHIFT
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define TRANSITION_SHIFT 2
+static inline uint64_t transitions16(const uint8_t *cur, const uint8_t *prev)
+{
+    // no movemask, narrow each compared byte to a nibble instead
+    uint8x16_t same = vceqq_u8(vld1q_u8(cur), vld1q_u8(prev));
+    uint64_t nibbles = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(same), 4)), 0);
+    return ~nibbles & 0x1111111111111111ull;
+}
+#elif defined(__SSE2__)
+#define TRANSITION_SHIFT 0
+static inline uint64_t transitions16(const uint8_t *cur, const uint8_t *prev)
+{
+    __m128i same = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)cur), _mm_loadu_si128((const __m128i *)prev));
+    return ~_mm_movemask_epi8(same) & 0xffff;
+}
+#else
+#define TRANSITION_SHIFT 0
+static inline uint64_t transitions16(const uint8_t *cur, const uint8_t *prev)
+{
+    uint64_t mask = 0;
+    for (int j = 0; j < 16; j++) {
+        mask |= (uint64_t)(cur[j] != prev[j]) << j;
+    }
+    return mask;
+}
+#endif
+
+int extractRuns(const uint8_t classes[], int pixels, Runs &runs)
+{
+    runs.clear();
+    if (pixels <= 0) {
+        return 0;
+    }
+
+    // a run ends wherever the class changes
+    uint32_t first = 0;
+    int i = 1;
+    for (; i + 16 <= pixels; i += 16) {
+        uint64_t mask = transitions16(classes + i, classes + i - 1);
+        while (mask) {
+            uint32_t end = i + (__builtin_ctzll(mask) >> TRANSITION_SHIFT);
+            runs.push(SYMBOL_CLASSES[classes[first]], first, end);
+            first = end;
+            mask &= mask - 1;
+        }
+    }
+    for (; i < pixels; i++) {
+        if (classes[i] != classes[i - 1]) {
+            runs.push(SYMBOL_CLASSES[classes[first]], first, i);
+            first = i;
+        }
+    }
+    runs.push(SYMBOL_CLASSES[classes[first]], first, pixels);
+
+    return runs.size();
+}
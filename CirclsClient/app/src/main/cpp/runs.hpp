@@ -0,0 +1,23 @@
+#ifndef RUNS_HPP
+#define RUNS_HPP
+#include <stdint.h>
+#include <vector>
+
+#define MAX_RUN 0xffff  // widest run stored, wider ones are split
+
+// runs of pixels with the same symbol class, kept as separate arrays
+struct Runs {
+    std::vector<char> symbol;       // 01RGBY symbol of each run
+    std::vector<uint16_t> width;    // pixels in each run
+    std::vector<uint32_t> start;    // first pixel of each run
+
+    int size() const { return symbol.size(); }
+    void clear();
+    void push(char s, uint32_t first, uint32_t end);
+};
+
+// takes the SYMBOL_CLASSES index of every pixel in a flat frame
+// replaces runs with the runs of equal classes, returns their number
+int extractRuns(const uint8_t classes[], int pixels, Runs &runs);
+
+#endif // RUNS_HPP
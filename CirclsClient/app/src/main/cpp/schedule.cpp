@@ -0,0 +1,60 @@
+#include "schedule.hpp"
+
+#define COST_ALPHA   0.25f   // weight of a new frame in the learned costs
+#define SCALE_ALPHA  0.05f   // weight of a new frame in the latency scale
+#define COST_DECAY   0.98f   // per frame, so tiers passed over are retried
+#define MIN_SCALE    0.5f
+#define MAX_SCALE    4.0f
+
+FrameScheduler::FrameScheduler(uint32_t budgetUs)
+    : budget(budgetUs), cost()
+{
+}
+
+Tier FrameScheduler::choose(int inFlight, int waiting, int workers, uint32_t &predictedUs)
+{
+    if (workers < 1) {
+        workers = 1;
+    }
+
+    // the frames ahead and behind share the workers with this one
+    float backlog = (inFlight + waiting) * recent;
+
+    int tier = TIER_FULL;
+    float latency = 0;
+    for (; tier > TIER_SKIP; tier--) {
+        latency = scale * (backlog + cost[tier]) / workers;
+        if (latency <= budget) {
+            break;
+        }
+    }
+    if (tier == TIER_SKIP) {
+        latency = 0;
+    }
+
+    // a tier measured under load looks cheaper as time passes, so it gets
+    // another chance once the load is gone
+    for (int t = tier + 1; t < NUM_TIERS; t++) {
+        cost[t] *= COST_DECAY;
+    }
+
+    predictedUs = (uint32_t)latency;
+    return (Tier)tier;
+}
+
+void FrameScheduler::update(Tier tier, uint32_t analyzeUs, uint32_t predictedUs, uint32_t latencyUs)
+{
+    if (tier == TIER_SKIP) {
+        return;
+    }
+
+    // the first frame at a tier is taken as is
+    cost[tier] = cost[tier] > 0 ? cost[tier] + COST_ALPHA * (analyzeUs - cost[tier]) : analyzeUs;
+    recent = recent > 0 ? recent + COST_ALPHA * (analyzeUs - recent) : analyzeUs;
+
+    if (predictedUs > 0) {
+        float ratio = scale * latencyUs / predictedUs;
+        scale += SCALE_ALPHA * (ratio - scale);
+        scale = scale < MIN_SCALE ? MIN_SCALE : scale > MAX_SCALE ? MAX_SCALE : scale;
+    }
+}
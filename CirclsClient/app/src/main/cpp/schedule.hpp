@@ -0,0 +1,45 @@
+#ifndef SCHEDULE_HPP
+#define SCHEDULE_HPP
+#include <stdint.h>
+
+// how much of the pipeline a frame goes through, cheapest first
+enum Tier {
+    TIER_SKIP = 0,      // released without looking at it
+    TIER_COARSE,        // tracked regions only, every few rows, short packets
+    TIER_ROI,           // tracked or detected regions, no whole frame fallback
+    TIER_FULL,          // everything, long packets included
+    NUM_TIERS
+};
+
+#define SCHEDULE_BUDGET_US  66000   // default latency budget, two frames at 30 fps
+#define COARSE_ROW_STEP     8       // least row step of coarse frames
+
+// picks the tier of each frame so its latency stays within a budget; the cost
+// of each tier is learned from the frames that ran at it and the frames ahead
+// are assumed to cost what recent frames did
+class FrameScheduler {
+public:
+    explicit FrameScheduler(uint32_t budgetUs = SCHEDULE_BUDGET_US);
+
+    void setBudget(uint32_t us) { budget = us; }
+    uint32_t getBudget() const { return budget; }
+
+    // takes the frames being decoded, the frames waiting behind the new one
+    // and the number of workers
+    // returns the richest tier expected to meet the budget and its predicted
+    // latency in us
+    Tier choose(int inFlight, int waiting, int workers, uint32_t &predictedUs);
+
+    // takes the tier a frame ran at, the worker time spent analyzing it, the
+    // latency predicted for it and its actual latency, all in us
+    void update(Tier tier, uint32_t analyzeUs, uint32_t predictedUs, uint32_t latencyUs);
+
+private:
+    uint32_t budget;
+    float cost[NUM_TIERS];  // worker us per frame at each tier, 0 until run
+    float recent = 0;       // worker us of recent frames at any tier
+    float scale = 1;        // actual latency over predicted, for what the
+                            // model leaves out like commits and contention
+};
+
+#endif // SCHEDULE_HPP
@@ -0,0 +1,130 @@
+#include "stream.hpp"
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#define SEARCH_STEP 64      // columns between preamble searches
+
+StreamDecoder::StreamDecoder(const ColorCalibrator &colors, Callback callback)
+    : colors(colors), callback(callback)
+{
+}
+
+void StreamDecoder::push(const int32_t columns[][3], int n)
+{
+    while (n > 0) {
+        int take = std::min(n, STREAM_COLUMNS - length);
+        memcpy(buffer[length], columns, sizeof(buffer[0]) * take);
+        length += take;
+        fresh += take;
+        columns += take;
+        n -= take;
+
+        // demodulate, and search again whenever a packet ends
+        for (;;) {
+            if (locked) {
+                receive(true);
+            }
+            if (locked || (fresh < SEARCH_STEP && length < STREAM_COLUMNS) || !search()) {
+                break;
+            }
+        }
+
+        // a packet that stopped advancing is lost
+        if (length == STREAM_COLUMNS) {
+            locked = false;
+            discard(STREAM_COLUMNS / 2);
+        }
+    }
+}
+
+void StreamDecoder::flush()
+{
+    // the preamble of a packet may be too recent to have been searched for
+    for (;;) {
+        if (locked) {
+            receive(false);
+        }
+        if (locked || fresh == 0 || !search()) {
+            break;
+        }
+    }
+
+    locked = false;
+    length = 0;
+    fresh = 0;
+}
+
+bool StreamDecoder::search()
+{
+    fresh = 0;
+
+    std::vector<Sync> syncs;
+    correlateSync(buffer, length, width, syncs);
+    for (Sync &sync : syncs) {
+        if (refineSync(buffer, length, sync)) {
+            locked = true;
+            clock = sync;
+            count = 0;
+            return true;
+        }
+    }
+
+    // keep enough to hold a preamble that is only partly in
+    if (length > STREAM_COLUMNS / 2) {
+        discard(length - STREAM_COLUMNS / 2);
+    }
+    return false;
+}
+
+void StreamDecoder::receive(bool more)
+{
+    // leave room for the clock to find the edges of the last symbol, unless
+    // no more are coming
+    int guard = more ? (int)ceilf(3 * clock.slot) : 0;
+
+    while (locked) {
+        int end;
+        int target = count < NSYM ? NSYM : NSYM_LONG;
+        count += demodulate(&soft[count], target - count, buffer, length - guard, clock, end);
+        if (count < target) {
+            break;
+        }
+
+        uint8_t data[NMSG_LONG+NPAR_LONG];
+        int erasures, corrected;
+        bool decoded = decodeSymbols(soft, count, colors, data, erasures, corrected);
+        if (decoded) {
+            width = clock.slot;
+            callback(data, count == NSYM ? NMSG : NMSG_LONG);
+        }
+
+        // a short packet that failed may still be the start of a long one
+        if (decoded || count == NSYM_LONG) {
+            locked = false;
+            discard(end);
+            fresh = length;
+        }
+    }
+
+    // drop columns the clock has passed
+    if (locked) {
+        int passed = (int)floorf(clock.start - 2 * clock.slot);
+        if (passed > 0) {
+            discard(passed);
+        }
+    }
+}
+
+void StreamDecoder::discard(int columns)
+{
+    if (columns > length) {
+        columns = length;
+    }
+    memmove(buffer, buffer[columns], sizeof(buffer[0]) * (length - columns));
+    length -= columns;
+    if (locked) {
+        clock.begin -= columns;
+        clock.start -= columns;
+    }
+}
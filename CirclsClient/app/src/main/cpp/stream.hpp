@@ -0,0 +1,59 @@
+#ifndef STREAM_HPP
+#define STREAM_HPP
+#include <stdint.h>
+#include <functional>
+#include "calibrate.hpp"
+#include "demod.hpp"
+#include "packet.hpp"
+
+#define STREAM_COLUMNS 512  // columns held while searching or demodulating
+
+// decodes packets from flat Lab columns pushed in readout order, a column or
+// a strip at a time, using memory independent of the frame size
+class StreamDecoder {
+public:
+    // takes a decoded message and its length
+    typedef std::function<void(const uint8_t *data, int len)> Callback;
+
+    // takes the colors to classify symbols by and the callback for packets
+    StreamDecoder(const ColorCalibrator &colors, Callback callback);
+
+    // takes flat Lab columns in readout order
+    // calls back as soon as the last symbol of a packet is in
+    void push(const int32_t columns[][3], int count);
+
+    // finishes the packets the columns buffered hold, calling back for
+    // them, then drops whatever was in progress, for when the columns stop
+    // being contiguous such as at the end of a frame
+    void flush();
+
+    // returns pixels per symbol slot of the last packet, 0 until one decoded
+    float slot() const { return width; }
+
+private:
+    // looks for a preamble in the buffered columns, returns true if found
+    bool search();
+
+    // takes whether more columns follow
+    // demodulates the buffered symbols of the current packet
+    void receive(bool more);
+
+    // drops the oldest columns
+    void discard(int columns);
+
+    const ColorCalibrator &colors;
+    Callback callback;
+
+    int32_t buffer[STREAM_COLUMNS][3];
+    int length = 0;         // columns buffered
+    int fresh = 0;          // columns pushed since the last search
+
+    bool locked = false;    // demodulating a packet
+    Sync clock;             // symbol clock, relative to the buffer
+    float soft[NSYM_LONG][3];
+    int count = 0;          // symbols demodulated
+
+    float width = 0;        // slot width of the last packet
+};
+
+#endif // STREAM_HPP
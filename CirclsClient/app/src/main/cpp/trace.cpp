@@ -0,0 +1,135 @@
+#include "trace.hpp"
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#define TRACE_MAGIC   0x43525443    // "CTRC" read as little endian
+#define TRACE_VERSION 1
+
+static const char *TRACE_NAMES[NUM_TRACE_IDS] = {
+    "submit", "analyze", "commit", "region", "detect", "idle", "runs", "sync", "decode", "combine",
+    "reassembly-lost", "message",
+};
+
+// an event as stored in a ring; a dump reads it while the owning thread may be
+// overwriting it, so each field is an atomic and a torn event is detected by
+// the ring's head rather than read as a data race
+struct TraceSlot {
+    std::atomic<uint64_t> time;
+    std::atomic<uint32_t> idThread; // id in the low half, thread in the high
+    std::atomic<int32_t> a;
+    std::atomic<int32_t> b;
+    std::atomic<int32_t> c;
+};
+
+// events of one thread, written by it alone
+struct TraceRing {
+    std::atomic<uint64_t> head{0};  // events ever written
+    uint16_t thread = 0;
+    TraceSlot events[TRACE_EVENTS];
+};
+
+// rings of every thread that traced, kept for good since threads are few and
+// may exit before a dump
+static std::mutex registryLock;
+static std::vector<std::unique_ptr<TraceRing>> rings;
+
+static TraceRing *threadRing()
+{
+    thread_local TraceRing *ring = nullptr;
+    if (ring == nullptr) {
+        std::lock_guard<std::mutex> lock(registryLock);
+        rings.emplace_back(new TraceRing());
+        ring = rings.back().get();
+        ring->thread = rings.size() - 1;
+    }
+    return ring;
+}
+
+void traceEvent(int id, int32_t a, int32_t b, int32_t c)
+{
+    TraceRing *ring = threadRing();
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    uint64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    // released, so a dump that sees any of this event also sees the head
+    // before it and knows the event TRACE_EVENTS before is being overwritten
+    TraceSlot &event = ring->events[head & (TRACE_EVENTS - 1)];
+    event.time.store(time, std::memory_order_release);
+    event.idThread.store((uint32_t)id | (uint32_t)ring->thread << 16, std::memory_order_release);
+    event.a.store(a, std::memory_order_release);
+    event.b.store(b, std::memory_order_release);
+    event.c.store(c, std::memory_order_release);
+
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+size_t traceDumpSize()
+{
+    std::lock_guard<std::mutex> lock(registryLock);
+    return 12 + rings.size() * (8 + sizeof(TraceEvent) * TRACE_EVENTS);
+}
+
+// takes a value and a position in a buffer
+// writes the value there and moves past it
+template <typename T>
+static void put(uint8_t *&out, T value)
+{
+    memcpy(out, &value, sizeof(value));
+    out += sizeof(value);
+}
+
+size_t traceDump(uint8_t *buffer, size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(registryLock);
+    if (capacity < 12 + rings.size() * (8 + sizeof(TraceEvent) * TRACE_EVENTS)) {
+        return 0;
+    }
+
+    uint8_t *out = buffer;
+    put<uint32_t>(out, TRACE_MAGIC);
+    put<uint16_t>(out, TRACE_VERSION);
+    put<uint16_t>(out, sizeof(TraceEvent));
+    put<uint32_t>(out, rings.size());
+
+    for (auto &ring : rings) {
+        // copy what the ring holds, then drop what was overwritten meanwhile
+        uint64_t end = ring->head.load(std::memory_order_acquire);
+        uint64_t begin = end > TRACE_EVENTS ? end - TRACE_EVENTS : 0;
+        uint8_t *events = out + 8;
+        for (uint64_t i = begin; i < end; i++) {
+            const TraceSlot &slot = ring->events[i & (TRACE_EVENTS - 1)];
+            TraceEvent event;
+            event.time = slot.time.load(std::memory_order_acquire);
+            uint32_t idThread = slot.idThread.load(std::memory_order_acquire);
+            event.id = idThread & 0xffff;
+            event.thread = idThread >> 16;
+            event.a = slot.a.load(std::memory_order_acquire);
+            event.b = slot.b.load(std::memory_order_acquire);
+            event.c = slot.c.load(std::memory_order_acquire);
+            memcpy(events + (i - begin) * sizeof(TraceEvent), &event, sizeof(event));
+        }
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        // the event being written replaces the one TRACE_EVENTS before it
+        uint64_t lost = head + 1 > begin + TRACE_EVENTS ? head + 1 - begin - TRACE_EVENTS : 0;
+        if (lost > end - begin) {
+            lost = end - begin;
+        }
+        memmove(events, events + lost * sizeof(TraceEvent), (end - begin - lost) * sizeof(TraceEvent));
+
+        put<uint32_t>(out, ring->thread);
+        put<uint32_t>(out, end - begin - lost);
+        out += (end - begin - lost) * sizeof(TraceEvent);
+    }
+
+    return out - buffer;
+}
+
+const char *traceName(int id)
+{
+    return id >= 0 && id < NUM_TRACE_IDS ? TRACE_NAMES[id] : "unknown";
+}
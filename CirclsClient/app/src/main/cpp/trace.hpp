@@ -0,0 +1,60 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+#include <stdint.h>
+#include <stddef.h>
+
+// events above this level compile away: 0 traces nothing, 1 the stages of
+// every frame, 2 every preamble and decode attempt as well
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL 1
+#endif
+
+#define TRACE_EVENTS 4096   // events kept per thread, a power of two
+
+enum TraceId {
+    TRACE_SUBMIT = 0,       // a: frame, b: regions
+    TRACE_ANALYZE,          // a: region, b: us spent, c: preambles found
+    TRACE_COMMIT,           // a: frame, b: us spent, c: packets reported
+    TRACE_REGION,           // a: region, b: SNR, c: row step
+    TRACE_DETECT,           // a: regions found, b: regions tracked before
+    TRACE_IDLE,             // a: region
+    TRACE_RUNS,             // a: runs, b: pixels
+    TRACE_SYNC,             // a: first pixel, b: score * 1000, c: slot * 1000
+    TRACE_DECODE,           // a: status, b: erasures, c: bytes corrected
+    TRACE_COMBINE,          // a: attempts, b: erasures, c: decoded
+    TRACE_REASSEMBLY_LOST,  // a: preamble that cut it short
+    TRACE_MESSAGE,          // a: region, b: id, c: length
+    NUM_TRACE_IDS
+};
+
+// one fixed-size binary event, as dumped
+struct TraceEvent {
+    uint64_t time;          // steady clock, ns
+    uint16_t id;
+    uint16_t thread;        // order in which threads first traced
+    int32_t a;
+    int32_t b;
+    int32_t c;
+};
+
+// takes an event and its arguments
+// appends it to the calling thread's ring, overwriting the oldest event
+// once full; only the calling thread writes to its ring, so this never locks
+void traceEvent(int id, int32_t a, int32_t b = 0, int32_t c = 0);
+
+// takes a buffer
+// dumps the events of every thread into it: the magic "CTRC", u16 version,
+// u16 event size and u32 thread count, then for each thread a u32 thread
+// index, u32 event count and its events oldest first; events overwritten
+// while dumping are left out; returns the bytes written, 0 if it does not fit
+size_t traceDump(uint8_t *buffer, size_t capacity);
+
+// returns the bytes traceDump needs at most
+size_t traceDumpSize();
+
+// returns the name of an event id
+const char *traceName(int id);
+
+#define TRACE(level, ...) do { if ((level) <= TRACE_LEVEL) traceEvent(__VA_ARGS__); } while (0)
+
+#endif // TRACE_HPP
@@ -28,13 +28,13 @@ public class MainActivity extends AppCompatActivity implements MessageHandler {
     private final BitSet window = new BitSet(MAX_ID);
     private int tail = 0;
     @Override
-    public void update(final Integer id, final String msg) {
+    public void update(final Integer region, final Integer id, final String msg) {
         runOnUiThread(new Runnable() {
             public void run() {
-                display.append(id + ":" + msg);
+                display.append(region + "/" + id + ":" + msg);
 
-                // if the message is in the window
-                if ((id - tail + MAX_ID) % MAX_ID <= WINDOW_SIZE) {
+                // if the message is in the window, NAKs only reach region 0
+                if (region == 0 && (id - tail + MAX_ID) % MAX_ID <= WINDOW_SIZE) {
                     // flag received
                     window.set(id);
 
@@ -114,7 +114,7 @@ public class MainActivity extends AppCompatActivity implements MessageHandler {
         // temporary
         console.setOnClickListener(new View.OnClickListener() {
             public void onClick(View v) {
-                update(tail, "ACK");
+                update(0, tail, "ACK");
             }
         });
 
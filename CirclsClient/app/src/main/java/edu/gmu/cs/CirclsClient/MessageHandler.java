@@ -1,5 +1,7 @@
 package edu.gmu.cs.CirclsClient;
 
 interface MessageHandler {
-    public void update(Integer id, String msg);
+    // region numbers the transmitter the message came from, 0 is the
+    // strongest one in view when it was first seen
+    public void update(Integer region, Integer id, String msg);
 }
@@ -9,48 +9,133 @@ import org.opencv.android.CameraGLSurfaceView;
 import org.opencv.android.LoaderCallbackInterface;
 import org.opencv.android.OpenCVLoader;
 
+import java.io.File;
+import java.io.FileInputStream;
+import java.io.FileOutputStream;
+import java.io.IOException;
 import java.nio.ByteBuffer;
-import java.util.concurrent.BlockingQueue;
-import java.util.concurrent.LinkedBlockingQueue;
+import java.nio.ByteOrder;
+import java.nio.charset.StandardCharsets;
 
 
 public class RxHandler implements CameraGLSurfaceView.CameraTextureListener {
     private static final String TAG = "RxHandler";
+    private static final String CALIBRATION_FILE = "calibration.bin";
+    private static final String TRACE_FILE = "trace.bin";
+    private static final String CAPTURE_FILE = "capture.ccap";
+    private static final int MAX_WIDTH = 960, MAX_HEIGHT = 720;
+    private static final int HIGH_WIDTH = 3840, HIGH_HEIGHT = 2160;
+
+    // native ring of frame buffers, shared with the decoder and sized for the
+    // preview, with up to 4 slots more than the native engine decodes at once;
+    // when it falls behind the oldest frame waiting is dropped
+    // set on the UI thread and read on the GL thread
+    private static final int RING_BYTES = 96 * 1024 * 1024;
+    private static final int MIN_SLOTS = 3, SPARE_SLOTS = 4;
+    private volatile ByteBuffer[] mSlots;
+    private Thread mConsumer;
 
-    private final BlockingQueue<ByteBuffer> mFrameQueue = new LinkedBlockingQueue<>();
     private BaseLoaderCallback mLoaderCallback;
     private MessageHandler mDisplay;
     private CameraGLSurfaceView mView;
-
-    private int mWidth = 0, mHeight = 0;
+    private File mCalibration;
+    private int mWidth, mHeight;    // preview size the calibration is learned at
 
     // jni
     static { System.loadLibrary("native-lib"); }
-    private native char[] FrameProcessor(int width, int height, ByteBuffer data);
+    private native ByteBuffer[] CreateRing(int slots, int capacity, boolean dropOldest);
+    private native void CloseRing();
+    private native int BeginFrame();
+    private native void EndFrame(int slot, int width, int height, long timestamp);
+    private native int TakeFrame();
+    private native boolean FramePending();
+    private native int EngineDepth();
+    private native void DropFrames();
+    private native void SubmitFrame(int slot);
+    private native int CollectReports(ByteBuffer reports, boolean wait);
+    private native byte[] SaveCalibration(int width, int height);
+    private native boolean LoadCalibration(byte[] blob, int width, int height);
+    private native byte[] DumpTrace();
+    private native long[] MetricsSnapshot();
+    private native String MetricsReport();
+    private native void SetLatencyBudget(int us);
+    private native boolean StartCapture(String path, boolean runs);
+    private native void StopCapture();
+
+    // packed reports of a decoded frame, see packResult in pipeline.hpp
+    private static final int FRAME_RECORD = 24, PACKET_RECORD = 16;
+    private static final int STATUS_FAILED = 4;
 
     class Consumer implements Runnable {
+        // frames submitted whose packets were not collected yet, at most as
+        // many as the ring can hold besides the ones being written and waiting
+        private int mInFlight = 0;
+        private final int mMaxInFlight;
+
+        // reused for every frame
+        private final ByteBuffer mReports = ByteBuffer.allocateDirect(64 * 1024).order(ByteOrder.LITTLE_ENDIAN);
+        private final byte[] mMessage = new byte[256];
+
+        Consumer(int slots, int depth) {
+            mMaxInFlight = Math.max(1, Math.min(depth, slots - 2));
+        }
+
         @Override
         public void run() {
-            while (true) {
-                try {
-                    char[] text = FrameProcessor(mWidth, mHeight, mFrameQueue.take());
+            int slot;
+            while ((slot = TakeFrame()) >= 0) {
+                SubmitFrame(slot);
+                mInFlight++;
 
-                    if (text.length > 1) {
-                        mDisplay.update((int) text[0], String.valueOf(text).substring(1));
+                // packets come back in capture order; only wait for them
+                // when the engine is full or no other frame is waiting
+                while (mInFlight > 0) {
+                    int size = CollectReports(mReports, mInFlight >= mMaxInFlight || !FramePending());
+                    if (size < 0) {
+                        break;
                     }
-                } catch (InterruptedException e) {
+                    mInFlight--;
+                    deliver(size);
+                }
+            }
+
+            // the ring was closed, hand over what is left before it goes away
+            int size;
+            while (mInFlight > 0 && (size = CollectReports(mReports, true)) >= 0) {
+                mInFlight--;
+                deliver(size);
+            }
+        }
+
+        // hands the messages of a frame's reports to the display
+        private void deliver(int size) {
+            if (size < FRAME_RECORD) {
+                return;
+            }
+            int count = mReports.getShort(FRAME_RECORD - 2) & 0xffff;
+
+            for (int i = 0, pos = FRAME_RECORD; i < count; i++) {
+                int region = mReports.get(pos) & 0xff;
+                int status = mReports.get(pos + 1) & 0xff;
+                int length = mReports.get(pos + 2) & 0xff;
+                if (status != STATUS_FAILED && length > 0) {
+                    mReports.position(pos + PACKET_RECORD);
+                    mReports.get(mMessage, 0, length);
+                    mDisplay.update(region, mMessage[0] & 0xff,
+                            new String(mMessage, 1, length - 1, StandardCharsets.ISO_8859_1));
                 }
+                pos += PACKET_RECORD + length;
             }
         }
     }
 
     public void setup(View view, MessageHandler display) {
         mDisplay = display;
-        new Thread(new Consumer()).start();
+        mCalibration = new File(view.getContext().getFilesDir(), CALIBRATION_FILE);
 
         // setup display
         mView = (CameraGLSurfaceView) view;
-        mView.setMaxCameraPreviewSize(960, 720);
+        mView.setMaxCameraPreviewSize(MAX_WIDTH, MAX_HEIGHT);
         mView.setCameraTextureListener(this);
 
         // setup callback for OpenCV loader
@@ -80,24 +165,134 @@ public class RxHandler implements CameraGLSurfaceView.CameraTextureListener {
         mView.disableView();
     }
 
+    // preview up to 3840x2160 where the camera offers it, for an LED too far
+    // away or too fast to resolve at 960x720, at the cost of memory and decode
+    // time; restarts the preview
+    public void setHighResolution(boolean high) {
+        mView.setMaxCameraPreviewSize(high ? HIGH_WIDTH : MAX_WIDTH, high ? HIGH_HEIGHT : MAX_HEIGHT);
+    }
+
+    // latency the native decoder keeps each frame within by decoding less of
+    // it, or none of it, when it falls behind; 0 restores the default
+    public void setLatencyBudget(int ms) {
+        SetLatencyBudget(ms * 1000);
+    }
+
+    // record the reduced frames the decoder sees from now on, a few KB each,
+    // replayed offline by tools/rxbatch; runs keeps their symbol runs as well
+    public void startCapture(boolean runs) {
+        File capture = new File(mCalibration.getParentFile(), CAPTURE_FILE);
+        if (!StartCapture(capture.getPath(), runs)) {
+            Log.e(TAG, "Failed to start capture " + capture);
+        }
+    }
+
+    public void stopCapture() {
+        StopCapture();
+    }
+
+    // counters and stage latencies of the native decoder since it was loaded:
+    // every counter, then count, min, p50, p90, p99 and max in us per stage,
+    // in the order of the Counter and Stage enums in metrics.hpp
+    public long[] getMetrics() {
+        return MetricsSnapshot();
+    }
+
+    // warm start the receiver from the last session
+    private void loadCalibration(int width, int height) {
+        if (!mCalibration.exists()) {
+            return;
+        }
+
+        byte[] blob = new byte[(int) mCalibration.length()];
+        try (FileInputStream in = new FileInputStream(mCalibration)) {
+            if (in.read(blob) != blob.length || !LoadCalibration(blob, width, height)) {
+                Log.d(TAG, "Discarding stale calibration");
+            }
+        } catch (IOException e) {
+            Log.e(TAG, "Failed to read calibration", e);
+        }
+    }
+
+    // save the native trace of the session, decoded offline by tools/tracedump
+    private void saveTrace() {
+        File trace = new File(mCalibration.getParentFile(), TRACE_FILE);
+        try (FileOutputStream out = new FileOutputStream(trace)) {
+            out.write(DumpTrace());
+        } catch (IOException e) {
+            Log.e(TAG, "Failed to save trace", e);
+        }
+    }
+
+    // save what the receiver learned for the next session
+    private void saveCalibration() {
+        try (FileOutputStream out = new FileOutputStream(mCalibration)) {
+            out.write(SaveCalibration(mWidth, mHeight));
+        } catch (IOException e) {
+            Log.e(TAG, "Failed to save calibration", e);
+        }
+    }
+
+    // a ring for frames of the preview size and a consumer decoding them
+    private void startDecoding(int width, int height) {
+        int frameBytes = width * height * 4;
+        int depth = EngineDepth();
+        int slots = Math.max(MIN_SLOTS, Math.min(depth + SPARE_SLOTS, RING_BYTES / frameBytes));
+        mSlots = CreateRing(slots, frameBytes, true);
+        mConsumer = new Thread(new Consumer(slots, depth));
+        mConsumer.start();
+    }
+
+    // wait for the consumer to hand over the frames it submitted
+    private void stopDecoding() {
+        mSlots = null;
+        DropFrames();
+        CloseRing();
+        try {
+            mConsumer.join();
+        } catch (InterruptedException e) {
+            Thread.currentThread().interrupt();
+        }
+    }
+
     @Override
     public void onCameraViewStarted(int width, int height) {
-        mWidth = width; mHeight = height;
+        mWidth = width;
+        mHeight = height;
+        startDecoding(width, height);
+        loadCalibration(width, height);
         Log.d(TAG, "Preview (" + width + "," + height + ")");
     }
 
     @Override
     public void onCameraViewStopped() {
-        mWidth = 0; mHeight = 0;
-        mFrameQueue.clear();
+        stopDecoding();
+        StopCapture();
+        saveCalibration();
+        saveTrace();
+        Log.d(TAG, "Metrics\n" + MetricsReport());
     }
 
     @Override
     public boolean onCameraTexture(int texIn, int texOut, int width, int height) {
-        // queue frame for processing
-        ByteBuffer pixels = ByteBuffer.allocateDirect(width * height * 4);
-        GLES20.glReadPixels(0, 0, width, height, GLES20.GL_RGBA, GLES20.GL_UNSIGNED_BYTE, pixels);
-        mFrameQueue.add(pixels);
+        // stamp the frame with its exposure; the callback runs with jitter far
+        // above a symbol slot and long packets are stitched across frames by time
+        long timestamp = mView.getTimestamp();
+        if (timestamp == 0) {
+            // another clock would throw the predictor and the stitching off
+            Log.e(TAG, "Frame without a sensor timestamp dropped");
+            return false;
+        }
+
+        // queue frame for processing, unless the ring is full of frames in flight
+        ByteBuffer[] slots = mSlots;
+        int slot = slots != null && width * height * 4 <= slots[0].capacity() ? BeginFrame() : -1;
+        if (slot >= 0) {
+            ByteBuffer pixels = slots[slot];
+            pixels.clear();
+            GLES20.glReadPixels(0, 0, width, height, GLES20.GL_RGBA, GLES20.GL_UNSIGNED_BYTE, pixels);
+            EndFrame(slot, width, height, timestamp);
+        }
 
         // output isn't modified
         return false;
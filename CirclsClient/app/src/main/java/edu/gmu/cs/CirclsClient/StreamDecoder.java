@@ -0,0 +1,47 @@
+package edu.gmu.cs.CirclsClient;
+
+import java.nio.ByteBuffer;
+
+// decodes packets from flat Lab columns pushed as they are read out, for
+// capture sources that deliver lines rather than whole frames; symbols are
+// classified by the colors the receiver had learned when it was created
+public class StreamDecoder implements AutoCloseable {
+    private final MessageHandler mDisplay;
+    private long mHandle;
+
+    // jni
+    static { System.loadLibrary("native-lib"); }
+    private native long Create();
+    private native void Push(long handle, ByteBuffer columns, int count);
+    private native void Flush(long handle);
+    private native void Destroy(long handle);
+
+    public StreamDecoder(MessageHandler display) {
+        mDisplay = display;
+        mHandle = Create();
+    }
+
+    // takes a direct buffer of count columns, 3 bytes of 8 bit Lab each;
+    // ignored unless the buffer holds that many
+    public void push(ByteBuffer columns, int count) {
+        Push(mHandle, columns, count);
+    }
+
+    // call where the columns stop being contiguous, such as between frames
+    public void flush() {
+        Flush(mHandle);
+    }
+
+    @Override
+    public void close() {
+        if (mHandle != 0) {
+            Destroy(mHandle);
+            mHandle = 0;
+        }
+    }
+
+    // called from push and flush with the id and message of every packet decoded
+    private void onPacket(char[] text) {
+        mDisplay.update(0, (int) text[0], String.valueOf(text, 1, text.length - 1));
+    }
+}
@@ -0,0 +1,317 @@
+// decodes recorded camera frames offline through the receiver's pipeline as
+// fast as the cores allow, and reports the packets decoded, the time spent in
+// each stage, the frame rate and the packet success rate
+//
+// build: cmake -S . -B build && cmake --build build
+// usage: build/rxbatch [-s 960x720] [-r 30] [-o out.ccap [-R]] [-x text [-m 1]] [-v] capture...
+//        a capture is a file of raw RGBA frames back to back, bottom row first
+//        as the app reads them, or a directory of them one per file in name
+//        order, both of the resolution given by -s; a video converts with
+//        ffmpeg -i capture.mp4 -vf vflip -f rawvideo -pix_fmt rgba capture.rgba
+//        it may also be a compact capture recorded by the app or by -o, which
+//        replays from the flat frames it holds, see capture.hpp
+//        -o records the capture decoded as a compact one, -R with the symbol
+//        runs of every region
+//        -x fails unless every message decoded is text after its id, as
+//        LedTest and rxsynth send them, and each capture decodes at least
+//        -m distinct messages
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <set>
+#include <string>
+#include <vector>
+#include "capture.hpp"
+#include "metrics.hpp"
+#include "pipeline.hpp"
+
+#define NO_BUDGET 0xffffffffu       // latency budget that never degrades a frame
+
+using namespace std::chrono;
+
+static const char *STATUS_NAMES[] = {"decoded", "combined", "long", "reassembled", "failed"};
+
+// where a frame of a capture is stored
+struct FrameSource {
+    std::string path;
+    off_t offset;
+};
+
+// what the captures decoded to
+struct Totals {
+    uint64_t frames = 0;
+    uint64_t decoded = 0;       // packets that decoded, repeats included
+    uint64_t failed = 0;        // packets found that did not
+    uint64_t messages = 0;      // distinct messages per capture
+    uint64_t unexpected = 0;    // messages decoded other than the one expected
+    double seconds = 0;
+};
+
+// takes a capture and the bytes of a frame
+// appends where each of its frames is stored, returns false if it is unreadable
+static bool listFrames(const char *capture, size_t frameBytes, std::vector<FrameSource> &frames)
+{
+    struct stat st;
+    if (stat(capture, &st) != 0) {
+        perror(capture);
+        return false;
+    }
+
+    if (!S_ISDIR(st.st_mode)) {
+        if (st.st_size % frameBytes != 0) {
+            fprintf(stderr, "%s: ignoring %lld bytes past the last frame\n", capture,
+                    (long long)(st.st_size % frameBytes));
+        }
+        for (off_t offset = 0; offset + (off_t)frameBytes <= st.st_size; offset += frameBytes) {
+            frames.push_back({capture, offset});
+        }
+        return true;
+    }
+
+    DIR *dir = opendir(capture);
+    if (dir == nullptr) {
+        perror(capture);
+        return false;
+    }
+    std::vector<std::string> paths;
+    while (struct dirent *entry = readdir(dir)) {
+        std::string path = std::string(capture) + "/" + entry->d_name;
+        struct stat file;
+        if (stat(path.c_str(), &file) == 0 && S_ISREG(file.st_mode) && (size_t)file.st_size == frameBytes) {
+            paths.push_back(path);
+        }
+    }
+    closedir(dir);
+
+    std::sort(paths.begin(), paths.end());
+    for (auto &path : paths) {
+        frames.push_back({path, 0});
+    }
+    return true;
+}
+
+// takes a frame, the file read last and a buffer of bytes
+// reads the frame into the buffer, keeping its file open for the next one,
+// returns false if it cannot be read
+static bool readFrame(const FrameSource &frame, FILE *&file, std::string &path, uint8_t *pixels, size_t bytes)
+{
+    if (file == nullptr || path != frame.path) {
+        if (file != nullptr) {
+            fclose(file);
+        }
+        path = frame.path;
+        file = fopen(path.c_str(), "rb");
+        if (file == nullptr) {
+            perror(path.c_str());
+            return false;
+        }
+    }
+    if (fseeko(file, frame.offset, SEEK_SET) != 0 || fread(pixels, 1, bytes, file) != bytes) {
+        fprintf(stderr, "%s: short read at %lld\n", path.c_str(), (long long)frame.offset);
+        return false;
+    }
+    return true;
+}
+
+// takes a capture, the resolution and frame rate of raw frames, the text every
+// message is expected to hold, nullptr if any, and whether to print packets
+// decodes every frame of it in order with as many in flight as the engine
+// holds, prints its report and adds it to totals; returns false if it cannot
+// be read
+static bool decodeCapture(const char *capture, int width, int height, double fps, const char *expected,
+                          bool verbose, Totals &totals)
+{
+    // a compact capture is read in place, raw frames are copied into the ring
+    CaptureReader reader;
+    bool replay = reader.open(capture);
+    size_t frameBytes = (size_t)width * height * 4;
+    std::vector<FrameSource> frames;
+    if (!replay && frameBytes == 0) {
+        fprintf(stderr, "%s: not a compact capture, raw frames need -s\n", capture);
+        return false;
+    }
+    if (!replay && !listFrames(capture, frameBytes, frames)) {
+        return false;
+    }
+
+    // every capture starts from a receiver that has seen nothing
+    resetReceivers();
+    metricsReset();
+    if (!replay) {
+        createRing(engineDepth + 1, frameBytes, false);
+    }
+
+    Totals capture_totals;
+    std::set<std::string> messages;
+    int64_t collected = 0;
+    auto collect = [&](const FrameResult &result) {
+        for (auto &packet : result.packets) {
+            if (packet.status == PACKET_FAILED) {
+                capture_totals.failed++;
+                continue;
+            }
+            capture_totals.decoded++;
+            messages.insert(std::string((const char *)packet.data, packet.length));
+            // long messages are padded with zeros
+            const char *text = (const char *)packet.data + 1;
+            if (expected != nullptr && packet.length > 0
+                && std::string(text, strnlen(text, packet.length - 1)) != expected)
+            {
+                capture_totals.unexpected++;
+                fprintf(stderr, "%s: frame %lld region %d: unexpected message %d \"%.*s\"\n", capture,
+                        (long long)collected, packet.region, packet.data[0], packet.length - 1, text);
+            }
+            if (verbose && packet.length > 0) {
+                printf("%s: frame %lld region %d %s, %d erased, %d corrected: %d \"%.*s\"\n", capture,
+                       (long long)collected, packet.region, STATUS_NAMES[packet.status], packet.erasures,
+                       packet.corrected, packet.data[0], packet.length - 1, (const char *)packet.data + 1);
+            }
+        }
+        collected++;
+    };
+
+    FILE *file = nullptr;
+    std::string path;
+    int in_flight = 0;
+    const CaptureFrame *recorded = replay ? reader.first() : nullptr;
+    auto start = steady_clock::now();
+    for (size_t i = 0; replay ? recorded != nullptr : i < frames.size(); i++) {
+        // packets come back in capture order; only wait for them when the
+        // engine is full
+        while (in_flight > 0 && collectFrame(collect, in_flight >= engineDepth)) {
+            in_flight--;
+        }
+
+        if (replay) {
+            submitCapture(*recorded);
+            recorded = reader.next(recorded);
+        } else {
+            // never blocks, a slot is free for every frame not in flight
+            int slot = ring->acquire();
+            if (!readFrame(frames[i], file, path, ring->data(slot), frameBytes)) {
+                ring->release(slot);
+                break;
+            }
+            ring->publish(slot, width, height, (int64_t)(i * 1e9 / fps));
+            submitFrame(ring->take());
+        }
+        in_flight++;
+        capture_totals.frames++;
+    }
+    while (in_flight > 0 && collectFrame(collect, true)) {
+        in_flight--;
+    }
+    capture_totals.seconds = duration<double>(steady_clock::now() - start).count();
+    capture_totals.messages = messages.size();
+    if (file != nullptr) {
+        fclose(file);
+    }
+
+    uint64_t found = capture_totals.decoded + capture_totals.failed;
+    printf("%s: %llu frames in %.2f s, %.1f fps, %llu/%llu packets decoded (%.1f%%), %llu messages\n",
+           capture, (unsigned long long)capture_totals.frames, capture_totals.seconds,
+           capture_totals.seconds > 0 ? capture_totals.frames / capture_totals.seconds : 0,
+           (unsigned long long)capture_totals.decoded, (unsigned long long)found,
+           found > 0 ? 100.0 * capture_totals.decoded / found : 0, (unsigned long long)capture_totals.messages);
+    printf("%s\n", metricsReport().c_str());
+
+    totals.frames += capture_totals.frames;
+    totals.decoded += capture_totals.decoded;
+    totals.failed += capture_totals.failed;
+    totals.messages += capture_totals.messages;
+    totals.unexpected += capture_totals.unexpected;
+    totals.seconds += capture_totals.seconds;
+    return true;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-s WIDTHxHEIGHT] [-r fps] [-o out.ccap [-R]] [-x text [-m messages]] [-v] "
+            "capture...\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    int width = 0, height = 0;
+    double fps = 30;
+    bool verbose = false;
+    const char *output = nullptr;
+    bool runs = false;
+    const char *expected = nullptr;
+    uint64_t minMessages = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:r:o:Rx:m:v")) != -1) {
+        switch (opt) {
+            case 's':
+                if (sscanf(optarg, "%dx%d", &width, &height) != 2) {
+                    width = height = -1;
+                }
+                break;
+            case 'r':
+                fps = atof(optarg);
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'R':
+                runs = true;
+                break;
+            case 'x':
+                expected = optarg;
+                break;
+            case 'm':
+                minMessages = strtoull(optarg, nullptr, 10);
+                break;
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    // a compact capture holds a single capture, decoded from a cold start
+    if (width < 0 || height < 0 || fps <= 0 || optind == argc || (output != nullptr && argc - optind > 1)) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // decode whole frames however long they take
+    setLatencyBudget(NO_BUDGET);
+    if (output != nullptr && !startCapture(output, runs)) {
+        perror(output);
+        return 1;
+    }
+
+    Totals totals;
+    int failed = 0;
+    for (int i = optind; i < argc; i++) {
+        Totals before = totals;
+        failed += !decodeCapture(argv[i], width, height, fps, expected, verbose, totals);
+        if (expected != nullptr && (totals.unexpected > before.unexpected
+                                    || totals.messages - before.messages < minMessages))
+        {
+            fprintf(stderr, "%s: %llu unexpected messages, %llu of at least %llu expected\n", argv[i],
+                    (unsigned long long)(totals.unexpected - before.unexpected),
+                    (unsigned long long)(totals.messages - before.messages), (unsigned long long)minMessages);
+            failed++;
+        }
+    }
+    stopCapture();
+
+    if (argc - optind > 1) {
+        uint64_t found = totals.decoded + totals.failed;
+        printf("total: %llu frames in %.2f s, %.1f fps, %llu/%llu packets decoded (%.1f%%), %llu messages\n",
+               (unsigned long long)totals.frames, totals.seconds,
+               totals.seconds > 0 ? totals.frames / totals.seconds : 0, (unsigned long long)totals.decoded,
+               (unsigned long long)found, found > 0 ? 100.0 * totals.decoded / found : 0,
+               (unsigned long long)totals.messages);
+    }
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,206 @@
+// renders the frames a camera would see of a transmitter running LedTest, for
+// decoding with rxbatch without a phone or an LED at hand; packets carry
+// LedTest's message, numbered in their first byte, and the LED fills a box in
+// the middle of the frame
+//
+// build: cmake -S . -B build && cmake --build build
+// usage: build/rxsynth [-s 960x720] [-r 30] [-w 4.4] [-n 0] [-f 60] [-l] capture.rgba
+//        -w pixels per symbol slot, at least as wide as the frame being read
+//        out within a frame interval allows, -n amplitude of the uniform
+//        noise added to each channel of a column of the LED, which averaging
+//        its rows does not remove, -f frames rendered, -l long packets as
+//        LedTest sends them with LONG_PACKET; frames are raw RGBA as rxbatch
+//        reads them, time running right to left across the columns
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include "packet.hpp"
+#include "rs.hpp"
+
+#define PACKETS     256         // ids before they wrap
+#define BACKGROUND  40          // gray level around the LED
+#define LED_MARGIN  0.05f       // share of each side of the frame without the LED
+
+static const char SHORT_MESSAGE[] = "Hello world!";
+static const char LONG_MESSAGE[] = "Hello world! This message spans frames.";
+
+// 8 bit Lab as OpenCV converts it of the LED showing each symbol class, in
+// the order of SYMBOL_CLASSES
+static const float LED_LAB[NUM_CLASSES][3] = {
+    {   5,   0,   0 },  // off
+    { 200,   0,   0 },  // white
+    { 120,  60,  30 },  // red
+    { 150, -60,  40 },  // green
+    {  80,  20, -60 },  // blue
+    { 200, -10,  80 },  // yellow
+};
+
+// takes the Lab f(t) of a channel, returns t
+static double labInverse(double f)
+{
+    return f > 6.0 / 29 ? f * f * f : 3 * (6.0 / 29) * (6.0 / 29) * (f - 4.0 / 29);
+}
+
+// takes a linear sRGB channel, returns it gamma encoded in 8 bits
+static uint8_t gammaEncode(double c)
+{
+    c = c < 0 ? 0 : c > 1 ? 1 : c;
+    c = c <= 0.0031308 ? 12.92 * c : 1.055 * pow(c, 1 / 2.4) - 0.055;
+    return (uint8_t)lround(c * 255);
+}
+
+// takes an 8 bit Lab color, stores it as sRGB in rgb
+static void labToRgb(const float lab[3], uint8_t rgb[3])
+{
+    double fy = (lab[0] * 100 / 255 + 16) / 116;
+    double x = 0.950456 * labInverse(fy + lab[1] / 500);
+    double y = labInverse(fy);
+    double z = 1.088754 * labInverse(fy - lab[2] / 200);
+    rgb[0] = gammaEncode(3.2404542 * x - 1.5371385 * y - 0.4985314 * z);
+    rgb[1] = gammaEncode(-0.9692660 * x + 1.8760108 * y + 0.0415560 * z);
+    rgb[2] = gammaEncode(0.0556434 * x - 0.2040259 * y + 1.0572252 * z);
+}
+
+// takes whether to send long packets
+// returns the symbol class the LED shows in each slot of a cycle through
+// every id, as LedTest's loop sends them: four times a white slot and two
+// off for the preamble, then every symbol followed by an off slot
+static std::vector<uint8_t> transmit(bool longPackets)
+{
+    RS::ReedSolomon<NMSG, NPAR> rs;
+    RS::ReedSolomon<NMSG_LONG, NPAR_LONG> rsLong;
+    int bytes = longPackets ? NMSG_LONG + NPAR_LONG : NMSG + NPAR;
+
+    std::vector<uint8_t> slots;
+    for (int id = 0; id < PACKETS; id++) {
+        uint8_t packet[NMSG_LONG+NPAR_LONG] = {};
+        packet[0] = id;
+        if (longPackets) {
+            memcpy(packet + 1, LONG_MESSAGE, sizeof(LONG_MESSAGE) - 1);
+            rsLong.Encode(packet, packet);
+        } else {
+            memcpy(packet + 1, SHORT_MESSAGE, sizeof(SHORT_MESSAGE) - 1);
+            rs.Encode(packet, packet);
+        }
+
+        for (int i = 0; i < 4; i++) {
+            slots.insert(slots.end(), {1, 0, 0});
+        }
+        for (int i = 0; i < bytes; i++) {
+            for (int j = 0; j < 8; j += 2) {
+                slots.insert(slots.end(), {(uint8_t)(2 + ((packet[i] >> j) & 3)), 0});
+            }
+        }
+    }
+    return slots;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-s WIDTHxHEIGHT] [-r fps] [-w slot] [-n noise] [-f frames] [-l] capture.rgba\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    int width = 960, height = 720;
+    double fps = 30;
+    double slot = 4.4;
+    int noise = 0;
+    int frames = 60;
+    bool longPackets = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:r:w:n:f:l")) != -1) {
+        switch (opt) {
+            case 's':
+                if (sscanf(optarg, "%dx%d", &width, &height) != 2) {
+                    width = height = 0;
+                }
+                break;
+            case 'r':
+                fps = atof(optarg);
+                break;
+            case 'w':
+                slot = atof(optarg);
+                break;
+            case 'n':
+                noise = atoi(optarg);
+                break;
+            case 'f':
+                frames = atoi(optarg);
+                break;
+            case 'l':
+                longPackets = true;
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if (width <= 0 || height <= 0 || fps <= 0 || slot <= 0 || noise < 0 || frames < 0 || optind + 1 != argc) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // a rolling shutter reads the frame out within the frame interval, the
+    // rest of it the transmitter sends unseen
+    double columnNs = SLOT_NS / slot;
+    if (width * columnNs > 1e9 / fps) {
+        fprintf(stderr, "%s: slots of %.2f pixels read a frame out in more than 1/%g s\n", argv[0], slot, fps);
+        return 2;
+    }
+
+    FILE *file = fopen(argv[optind], "wb");
+    if (file == nullptr) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    uint8_t colors[NUM_CLASSES][3];
+    for (int k = 0; k < NUM_CLASSES; k++) {
+        labToRgb(LED_LAB[k], colors[k]);
+    }
+    std::vector<uint8_t> slots = transmit(longPackets);
+
+    int left = lroundf(width * LED_MARGIN), right = width - left;
+    int top = lroundf(height * LED_MARGIN), bottom = height - top;
+    std::vector<uint8_t> frame((size_t)width * height * 4);
+
+    // the same noise on every run, so a capture can be compared across builds
+    uint32_t random = 1;
+    for (int f = 0; f < frames; f++) {
+        // columns read out since the first frame began
+        double first = f * 1e9 / fps / columnNs;
+        for (int x = 0; x < width; x++) {
+            size_t k = (size_t)floor((first + width - 1 - x) / slot) % slots.size();
+            uint8_t led[3];
+            for (int c = 0; c < 3; c++) {
+                int value = colors[slots[k]][c];
+                if (noise > 0) {
+                    random = random * 1664525 + 1013904223;
+                    value += (int)(random >> 8) % (2 * noise + 1) - noise;
+                }
+                led[c] = value < 0 ? 0 : value > 255 ? 255 : value;
+            }
+            for (int y = 0; y < height; y++) {
+                uint8_t *px = &frame[((size_t)y * width + x) * 4];
+                bool inside = x >= left && x < right && y >= top && y < bottom;
+                for (int c = 0; c < 3; c++) {
+                    px[c] = inside ? led[c] : BACKGROUND;
+                }
+                px[3] = 255;
+            }
+        }
+        if (fwrite(frame.data(), 1, frame.size(), file) != frame.size()) {
+            perror(argv[optind]);
+            fclose(file);
+            return 1;
+        }
+    }
+    fclose(file);
+    return 0;
+}
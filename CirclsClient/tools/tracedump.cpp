@@ -0,0 +1,84 @@
+// decodes a trace dumped by the receiver into text, one event per line in
+// time order across threads
+//
+// build: cmake -S . -B build && cmake --build build
+// usage: adb exec-out run-as edu.gmu.cs.CirclsClient cat files/trace.bin > trace.bin
+//        build/tracedump trace.bin
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "trace.hpp"
+
+// takes a position in the dump and the end of it
+// reads a value and moves past it, returns false if the dump ends first
+template <typename T>
+static bool get(const uint8_t *&in, const uint8_t *end, T &value)
+{
+    if (end - in < (long)sizeof(value)) {
+        return false;
+    }
+    memcpy(&value, in, sizeof(value));
+    in += sizeof(value);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s trace.bin\n", argv[0]);
+        return 2;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (file == nullptr) {
+        perror(argv[1]);
+        return 1;
+    }
+    std::vector<uint8_t> dump;
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        dump.insert(dump.end(), chunk, chunk + n);
+    }
+    fclose(file);
+
+    const uint8_t *in = dump.data(), *end = dump.data() + dump.size();
+    uint32_t magic, threads;
+    uint16_t version, size;
+    if (!get(in, end, magic) || !get(in, end, version) || !get(in, end, size) || !get(in, end, threads)
+        || memcmp(&magic, "CTRC", 4) != 0 || size != sizeof(TraceEvent))
+    {
+        fprintf(stderr, "%s: not a trace\n", argv[1]);
+        return 1;
+    }
+
+    std::vector<TraceEvent> events;
+    for (uint32_t t = 0; t < threads; t++) {
+        uint32_t thread, count;
+        if (!get(in, end, thread) || !get(in, end, count)) {
+            fprintf(stderr, "%s: truncated\n", argv[1]);
+            return 1;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            TraceEvent event;
+            if (!get(in, end, event)) {
+                fprintf(stderr, "%s: truncated\n", argv[1]);
+                return 1;
+            }
+            events.push_back(event);
+        }
+    }
+
+    // interleave the threads
+    std::stable_sort(events.begin(), events.end(), [](const TraceEvent &x, const TraceEvent &y) {
+        return x.time < y.time;
+    });
+    uint64_t start = events.empty() ? 0 : events.front().time;
+    for (auto &event : events) {
+        printf("%12.3f ms  t%-2u %-16s %d %d %d\n", (event.time - start) / 1e6, event.thread,
+               traceName(event.id), event.a, event.b, event.c);
+    }
+
+    return 0;
+}
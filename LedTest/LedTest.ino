@@ -16,6 +16,14 @@ uint8_t symbols[] = {
     0b1000  // yellow
   };
 
+// define LONG_PACKET to send codewords that span several camera frames
+#ifdef LONG_PACKET
+#define NMSG 48
+#define NPAR 16
+char packet[NMSG + NPAR] =
+    "\x0"                                      // id
+    "Hello world! This message spans frames."; // message, parity follows
+#else
 char packet[] =
     "\x0"          // id
     "Hello world!" // message
@@ -39,9 +47,12 @@ char packet[] =
  *    1d  00 01 11 01  GYGR
  *    5b  01 01 10 11  YBGG
  */
+#endif
 
+#ifndef LONG_PACKET
 #define NMSG 13
 #define NPAR 4
+#endif
 RS::ReedSolomon<NMSG, NPAR> rs;
 
 void setup() {
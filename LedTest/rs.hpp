@@ -20,6 +20,9 @@ namespace RS {
 
 #define MSG_CNT 3   // message-length polynomials count
 #define POLY_CNT 14 // (ecc_length*2)-length polynomials count
+// message polynomials hold the parity too, and the errata evaluator product
+// grows two past ecc_length*2 when every parity symbol is used
+#define POLY_MEMORY(msg, ecc) (MSG_CNT * ((msg) + (ecc)) + POLY_CNT * ((ecc) * 2 + 2))
 
 template <const uint8_t msg_length,  // Message length without correction code
           const uint8_t ecc_length>  // Length of correction code
@@ -28,7 +31,7 @@ class ReedSolomon {
 public:
     ReedSolomon() {
         const uint8_t   enc_len  = msg_length + ecc_length;
-        const uint8_t   poly_len = ecc_length * 2;
+        const uint8_t   poly_len = ecc_length * 2 + 2;
         uint8_t** memptr   = &memory;
         uint16_t  offset   = 0;
 
@@ -70,7 +73,7 @@ public:
         static bool    generator_cached = false;
 
         /* Allocating memory on stack for polynomials storage */
-        uint8_t stack_memory[MSG_CNT * msg_length + POLY_CNT * ecc_length * 2];
+        uint8_t stack_memory[POLY_MEMORY(msg_length, ecc_length)];
         this->memory = stack_memory;
 
         const uint8_t* src_ptr = (const uint8_t*) src;
@@ -146,7 +149,7 @@ public:
         bool ok;
 
         /* Allocation memory on stack */
-        uint8_t stack_memory[MSG_CNT * msg_length + POLY_CNT * ecc_length * 2];
+        uint8_t stack_memory[POLY_MEMORY(msg_length, ecc_length)];
         this->memory = stack_memory;
 
         Poly *msg_in  = &polynoms[ID_MSG_IN];
@@ -193,7 +196,8 @@ public:
         if(!has_errors) goto return_corrected_msg;
 
         CalcForneySyndromes(synd, epos, src_len);
-        FindErrorLocator(forney, NULL, epos->length);
+        ok = FindErrorLocator(forney, NULL, epos->length);
+        if(!ok) return 1;
 
         // Reversing syndrome
         // TODO optimize through special Poly flag
@@ -207,7 +211,8 @@ public:
         if(!ok) return 1;
 
         // Error happened while finding errors (so helpful :D)
-        if(err->length == 0) return 1;
+        // no errors besides the known erasures is fine though
+        if(err->length == 0 && epos->length == 0) return 1;
 
         /* Adding found errors with known */
         for(uint8_t i = 0; i < err->length; i++) {
@@ -470,8 +475,9 @@ private:
         uint32_t shift = 0;
         while(err_loc->length && err_loc->at(shift) == 0) shift++;
 
-        uint32_t errs = err_loc->length - shift - 1;
-        if(((errs - erase_count) * 2 + erase_count) > ecc_length){
+        // signed, there may be fewer errors than erasures
+        int32_t errs = err_loc->length - shift - 1;
+        if(((errs - (int32_t)erase_count) * 2 + (int32_t)erase_count) > ecc_length){
             return false; /* Error count is greater than we can fix! */
         }
 